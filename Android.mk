@@ -5,6 +5,7 @@ legacy_modules := power uevent vibrator wifi qemu qemu_tracing
 
 SAVE_MAKEFILES := $(call all-named-subdir-makefiles,$(legacy_modules))
 LEGACY_AUDIO_MAKEFILES := $(call all-named-subdir-makefiles,audio)
+GSCAN_MAKEFILES := $(call all-named-subdir-makefiles,gscan)
 
 LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
@@ -44,6 +45,35 @@ LOCAL_SHARED_LIBRARIES := libcutils
 
 include $(BUILD_SHARED_LIBRARY)
 
+# uevent_bench: records live uevents and replays them through the dispatcher
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := uevent_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := uevent/uevent_bench.c
+
+LOCAL_SHARED_LIBRARIES := libhardware_legacy
+
+include $(BUILD_EXECUTABLE)
+
+# wifi_bench: measures the wifi_* API against a fake wpa_supplicant
+ifdef WPA_SUPPLICANT_VERSION
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := wifi_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := wifi/wifi_bench.c
+
+LOCAL_SHARED_LIBRARIES := libhardware_legacy libcutils
+
+include $(BUILD_EXECUTABLE)
+endif
+
 # legacy_audio builds it's own set of libraries that aren't linked into
 # hardware_legacy
 include $(LEGACY_AUDIO_MAKEFILES)
+
+# reference GSCAN engine, not part of hardware_legacy either
+include $(GSCAN_MAKEFILES)
@@ -22,6 +22,8 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
     AudioPolicyManagerBase.cpp \
     AudioPolicyCompatClient.cpp \
+    AudioPolicyLatency.cpp \
+    AudioPolicyTrace.cpp \
     audio_policy_hal.cpp
 
 ifeq ($(AUDIO_POLICY_TEST),true)
@@ -82,3 +84,5 @@ include $(BUILD_SHARED_LIBRARY)
 
 #    AudioHardwareGeneric.cpp \
 #    AudioHardwareStub.cpp \
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -27,11 +27,13 @@
 #include <hardware_legacy/AudioSystemLegacy.h>
 
 #include "AudioPolicyCompatClient.h"
+#include "AudioPolicyLatency.h"
 
 namespace android_audio_legacy {
 
 audio_module_handle_t AudioPolicyCompatClient::loadHwModule(const char *moduleName)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_LOAD_HW_MODULE);
     return mServiceOps->load_hw_module(mService, moduleName);
 }
 
@@ -44,6 +46,7 @@ audio_io_handle_t AudioPolicyCompatClient::openOutput(audio_module_handle_t modu
                                                       audio_output_flags_t flags,
                                                       const audio_offload_info_t *offloadInfo)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_OPEN_OUTPUT);
     return mServiceOps->open_output_on_module(mService, module, pDevices, pSamplingRate,
                                               pFormat, pChannelMask, pLatencyMs,
                                               flags, offloadInfo);
@@ -52,21 +55,25 @@ audio_io_handle_t AudioPolicyCompatClient::openOutput(audio_module_handle_t modu
 audio_io_handle_t AudioPolicyCompatClient::openDuplicateOutput(audio_io_handle_t output1,
                                                           audio_io_handle_t output2)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_OPEN_DUPLICATE_OUTPUT);
     return mServiceOps->open_duplicate_output(mService, output1, output2);
 }
 
 status_t AudioPolicyCompatClient::closeOutput(audio_io_handle_t output)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_CLOSE_OUTPUT);
     return mServiceOps->close_output(mService, output);
 }
 
 status_t AudioPolicyCompatClient::suspendOutput(audio_io_handle_t output)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_SUSPEND_OUTPUT);
     return mServiceOps->suspend_output(mService, output);
 }
 
 status_t AudioPolicyCompatClient::restoreOutput(audio_io_handle_t output)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_RESTORE_OUTPUT);
     return mServiceOps->restore_output(mService, output);
 }
 
@@ -76,23 +83,27 @@ audio_io_handle_t AudioPolicyCompatClient::openInput(audio_module_handle_t modul
                                                      audio_format_t *pFormat,
                                                      audio_channel_mask_t *pChannelMask)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_OPEN_INPUT);
     return mServiceOps->open_input_on_module(mService, module, pDevices,
                                              pSamplingRate, pFormat, pChannelMask);
 }
 
 status_t AudioPolicyCompatClient::closeInput(audio_io_handle_t input)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_CLOSE_INPUT);
     return mServiceOps->close_input(mService, input);
 }
 
 status_t AudioPolicyCompatClient::invalidateStream(AudioSystem::stream_type stream)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_INVALIDATE_STREAM);
     return mServiceOps->invalidate_stream(mService, (audio_stream_type_t)stream);
 }
 
 status_t AudioPolicyCompatClient::moveEffects(int session, audio_io_handle_t srcOutput,
                                                audio_io_handle_t dstOutput)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_MOVE_EFFECTS);
     return mServiceOps->move_effects(mService, session, srcOutput, dstOutput);
 }
 
@@ -100,6 +111,7 @@ String8 AudioPolicyCompatClient::getParameters(audio_io_handle_t ioHandle, const
 {
     char *str;
     String8 out_str8;
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_GET_PARAMETERS);
 
     str = mServiceOps->get_parameters(mService, ioHandle, keys.string());
     out_str8 = String8(str);
@@ -112,6 +124,7 @@ void AudioPolicyCompatClient::setParameters(audio_io_handle_t ioHandle,
                                             const String8& keyValuePairs,
                                             int delayMs)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_SET_PARAMETERS);
     mServiceOps->set_parameters(mService, ioHandle, keyValuePairs.string(),
                            delayMs);
 }
@@ -122,6 +135,7 @@ status_t AudioPolicyCompatClient::setStreamVolume(
                                              audio_io_handle_t output,
                                              int delayMs)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_SET_STREAM_VOLUME);
     return mServiceOps->set_stream_volume(mService, (audio_stream_type_t)stream,
                                           volume, output, delayMs);
 }
@@ -129,6 +143,7 @@ status_t AudioPolicyCompatClient::setStreamVolume(
 status_t AudioPolicyCompatClient::startTone(ToneGenerator::tone_type tone,
                                        AudioSystem::stream_type stream)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_START_TONE);
     return mServiceOps->start_tone(mService,
                                    AUDIO_POLICY_TONE_IN_CALL_NOTIFICATION,
                                    (audio_stream_type_t)stream);
@@ -136,11 +151,13 @@ status_t AudioPolicyCompatClient::startTone(ToneGenerator::tone_type tone,
 
 status_t AudioPolicyCompatClient::stopTone()
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_STOP_TONE);
     return mServiceOps->stop_tone(mService);
 }
 
 status_t AudioPolicyCompatClient::setVoiceVolume(float volume, int delayMs)
 {
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::CLIENT_SET_VOICE_VOLUME);
     return mServiceOps->set_voice_volume(mService, volume, delayMs);
 }
 
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyLatency"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include "AudioPolicyLatency.h"
+
+namespace android_audio_legacy {
+    using android::String8;
+
+// zero initialized: no static constructor needed and usable before the policy is created
+static volatile int32_t sCounts[AudioPolicyLatency::NUM_HISTOGRAMS]
+                               [AudioPolicyLatency::NUM_BUCKETS];
+static volatile int32_t sMaxUs[AudioPolicyLatency::NUM_HISTOGRAMS];
+
+uint32_t AudioPolicyLatency::bucketForValue(uint32_t us)
+{
+    if (us < SUB_BUCKETS) {
+        return us;
+    }
+    uint32_t exponent = 31 - __builtin_clz(us);
+    if (exponent > MAX_EXPONENT) {
+        return NUM_BUCKETS - 1;
+    }
+    uint32_t sub = (us >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint32_t AudioPolicyLatency::bucketLowerBound(uint32_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint32_t sub = bucket % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS);
+}
+
+void AudioPolicyLatency::record(histogram h, nsecs_t duration)
+{
+    if ((uint32_t)h >= NUM_HISTOGRAMS) {
+        return;
+    }
+    nsecs_t us = ns2us(duration);
+    // anything above 2^30 us lands in the last bucket anyway
+    uint32_t value = (us < 0) ? 0 : ((us > (1 << 30)) ? (1 << 30) : (uint32_t)us);
+
+    android_atomic_inc(&sCounts[h][bucketForValue(value)]);
+
+    int32_t max = android_atomic_acquire_load(&sMaxUs[h]);
+    while ((int32_t)value > max) {
+        if (android_atomic_release_cas(max, (int32_t)value, &sMaxUs[h]) == 0) {
+            break;
+        }
+        max = android_atomic_acquire_load(&sMaxUs[h]);
+    }
+}
+
+const char *AudioPolicyLatency::name(uint32_t h)
+{
+    static const char * const sNames[NUM_HISTOGRAMS - NUM_TRACED_ENTRY_POINTS] = {
+        "getDeviceConnectionState",
+        "getForceUse",
+        "getStreamVolumeIndex",
+        "getStrategyForStream",
+        "getDevicesForStream",
+        "getOutputForEffect",
+        "registerEffect",
+        "unregisterEffect",
+        "setEffectEnabled",
+        "isStreamActive",
+        "isStreamActiveRemotely",
+        "isSourceActive",
+        "isOffloadSupported",
+        "setRingerMode",
+        "initCheck",
+        "wait: mute strategies",
+        "wait: start output",
+        "client: loadHwModule",
+        "client: openOutput",
+        "client: openDuplicateOutput",
+        "client: closeOutput",
+        "client: suspendOutput",
+        "client: restoreOutput",
+        "client: openInput",
+        "client: closeInput",
+        "client: invalidateStream",
+        "client: moveEffects",
+        "client: getParameters",
+        "client: setParameters",
+        "client: setStreamVolume",
+        "client: startTone",
+        "client: stopTone",
+        "client: setVoiceVolume",
+    };
+    if (h < NUM_TRACED_ENTRY_POINTS) {
+        return AudioPolicyTrace::eventName(h);
+    }
+    if (h >= NUM_HISTOGRAMS) {
+        return "unknown";
+    }
+    return sNames[h - NUM_TRACED_ENTRY_POINTS];
+}
+
+status_t AudioPolicyLatency::dump(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    snprintf(buffer, SIZE, "\nAudio policy latency (us):\n");
+    result.append(buffer);
+    snprintf(buffer, SIZE, " %-28s %9s %9s %9s %9s %9s\n",
+             "Call", "Count", "p50", "p90", "p99", "Max");
+    result.append(buffer);
+
+    for (uint32_t h = 0; h < NUM_HISTOGRAMS; h++) {
+        // copy the counters first so that percentiles are consistent with the total
+        uint32_t counts[NUM_BUCKETS];
+        uint64_t total = 0;
+        for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+            counts[b] = (uint32_t)android_atomic_acquire_load(&sCounts[h][b]);
+            total += counts[b];
+        }
+        if (total == 0) {
+            continue;
+        }
+
+        // percentiles are reported as the upper bound of the bucket they fall in
+        static const uint32_t kPercentiles[] = { 50, 90, 99 };
+        uint32_t values[3];
+        uint64_t cumulated = 0;
+        uint32_t p = 0;
+        for (uint32_t b = 0; b < NUM_BUCKETS && p < 3; b++) {
+            cumulated += counts[b];
+            while (p < 3 && cumulated * 100 >= total * kPercentiles[p]) {
+                values[p++] = (b + 1 < NUM_BUCKETS) ? bucketLowerBound(b + 1) - 1 :
+                                                      bucketLowerBound(b);
+            }
+        }
+        uint32_t max = (uint32_t)android_atomic_acquire_load(&sMaxUs[h]);
+        for (p = 0; p < 3; p++) {
+            if (values[p] > max) {
+                values[p] = max;
+            }
+        }
+        snprintf(buffer, SIZE, " %-28s %9llu %9u %9u %9u %9u\n",
+                 name(h), (unsigned long long)total, values[0], values[1], values[2], max);
+        result.append(buffer);
+    }
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
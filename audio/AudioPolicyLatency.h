@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYLATENCY_H
+#define ANDROID_AUDIOPOLICYLATENCY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+
+#include <hardware_legacy/AudioSystemLegacy.h>
+
+#include "AudioPolicyTrace.h"
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+// AudioPolicyLatency keeps one latency histogram per audio policy HAL entry point, per
+// AudioFlinger callback made by the policy and for the time the policy sleeps waiting for
+// output buffers to drain. Histograms are always on and process wide: they live in static
+// storage and are updated with atomic increments, so recording never takes a lock nor
+// allocates and can be done from any thread.
+//
+// Buckets are log-linear: values below SUB_BUCKETS us have one bucket each, then each
+// power of 2 is split in SUB_BUCKETS equal buckets, which bounds the error on reported
+// percentiles to 1/SUB_BUCKETS of the value.
+class AudioPolicyLatency
+{
+public:
+    enum histogram {
+        // entry points also recorded by AudioPolicyTrace, same values as AudioPolicyTrace::event
+        NUM_TRACED_ENTRY_POINTS = AudioPolicyTrace::NUM_EVENTS,
+        // other entry points
+        GET_DEVICE_CONNECTION_STATE = NUM_TRACED_ENTRY_POINTS,
+        GET_FORCE_USE,
+        GET_STREAM_VOLUME_INDEX,
+        GET_STRATEGY_FOR_STREAM,
+        GET_DEVICES_FOR_STREAM,
+        GET_OUTPUT_FOR_EFFECT,
+        REGISTER_EFFECT,
+        UNREGISTER_EFFECT,
+        SET_EFFECT_ENABLED,
+        IS_STREAM_ACTIVE,
+        IS_STREAM_ACTIVE_REMOTELY,
+        IS_SOURCE_ACTIVE,
+        IS_OFFLOAD_SUPPORTED,
+        SET_RINGER_MODE,
+        INIT_CHECK,
+        // sleeps inside the policy manager
+        MUTE_WAIT,                  // checkDeviceMuteStrategies()
+        START_OUTPUT_WAIT,          // startOutput()
+        // AudioPolicyClientInterface callbacks
+        CLIENT_LOAD_HW_MODULE,
+        CLIENT_OPEN_OUTPUT,
+        CLIENT_OPEN_DUPLICATE_OUTPUT,
+        CLIENT_CLOSE_OUTPUT,
+        CLIENT_SUSPEND_OUTPUT,
+        CLIENT_RESTORE_OUTPUT,
+        CLIENT_OPEN_INPUT,
+        CLIENT_CLOSE_INPUT,
+        CLIENT_INVALIDATE_STREAM,
+        CLIENT_MOVE_EFFECTS,
+        CLIENT_GET_PARAMETERS,
+        CLIENT_SET_PARAMETERS,
+        CLIENT_SET_STREAM_VOLUME,
+        CLIENT_START_TONE,
+        CLIENT_STOP_TONE,
+        CLIENT_SET_VOICE_VOLUME,
+        NUM_HISTOGRAMS
+    };
+
+    static const uint32_t SUB_BUCKET_BITS = 3;
+    static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const uint32_t MAX_EXPONENT = 25;        // values are clamped to 2^26 us (~67s)
+    static const uint32_t NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    static void record(histogram h, nsecs_t duration);
+
+    // writes count, percentiles and max of every histogram used so far
+    static status_t dump(int fd);
+
+    static const char *name(uint32_t h);
+
+    static uint32_t bucketForValue(uint32_t us);
+    // smallest value in us falling in the bucket
+    static uint32_t bucketLowerBound(uint32_t bucket);
+
+    // Records the time spent in its scope.
+    class Timer
+    {
+    public:
+        Timer(histogram h) : mHistogram(h), mStart(systemTime()) {}
+        ~Timer() { record(mHistogram, systemTime() - mStart); }
+
+    private:
+        histogram mHistogram;
+        nsecs_t mStart;
+    };
+
+private:
+    AudioPolicyLatency();
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYLATENCY_H
@@ -42,6 +42,8 @@
 #include <hardware_legacy/audio_policy_conf.h>
 #include <hardware_legacy/AudioPolicyManagerBase.h>
 
+#include "AudioPolicyLatency.h"
+
 namespace android_audio_legacy {
 
 // ----------------------------------------------------------------------------
@@ -52,6 +54,126 @@ namespace android_audio_legacy {
 status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device,
                                                   AudioSystem::device_connection_state state,
                                                   const char *device_address)
+{
+    if (mDeviceConnectionBatch) {
+        return updateDeviceConnectionState(device, state, device_address);
+    }
+    beginDeviceConnectionChanges();
+    status_t status = updateDeviceConnectionState(device, state, device_address);
+    commitDeviceConnectionChanges();
+    return status;
+}
+
+status_t AudioPolicyManagerBase::setDeviceConnectionStates(const DeviceConnectionChange *changes,
+                                                           size_t count)
+{
+    status_t status = NO_ERROR;
+
+    beginDeviceConnectionChanges();
+    for (size_t i = 0; i < count; i++) {
+        status_t result = setDeviceConnectionState(changes[i].mDevice,
+                                                   changes[i].mState,
+                                                   changes[i].mAddress);
+        if (result != NO_ERROR && status == NO_ERROR) {
+            status = result;
+        }
+    }
+    commitDeviceConnectionChanges();
+    return status;
+}
+
+void AudioPolicyManagerBase::beginDeviceConnectionChanges()
+{
+    if (mDeviceConnectionBatch) {
+        ALOGW("beginDeviceConnectionChanges() already in a transaction");
+        return;
+    }
+    mDeviceConnectionBatch = true;
+    mBatchOutputDevicesChanged = false;
+    mBatchInputDevicesChanged = false;
+    mBatchOutputChanges = 0;
+    // save a copy of the opened output descriptors before any output is opened or closed
+    // by checkOutputsForDevice(). This will be needed by checkOutputForAllStrategies()
+    mBatchPreviousOutputs = mOutputs;
+    mBatchOutputDevices.clear();
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        mBatchOutputDevices.add(mOutputs.keyAt(i), mOutputs.valueAt(i)->device());
+    }
+}
+
+status_t AudioPolicyManagerBase::commitDeviceConnectionChanges()
+{
+    if (!mDeviceConnectionBatch) {
+        ALOGW("commitDeviceConnectionChanges() not in a transaction");
+        return INVALID_OPERATION;
+    }
+    mDeviceConnectionBatch = false;
+
+    if (mBatchOutputDevicesChanged) {
+        // outputs closed since the transaction started have been deleted: do not let
+        // checkOutputForAllStrategies() see them
+        mPreviousOutputs.clear();
+        for (size_t i = 0; i < mBatchPreviousOutputs.size(); i++) {
+            audio_io_handle_t output = mBatchPreviousOutputs.keyAt(i);
+            if (mOutputs.indexOfKey(output) >= 0) {
+                mPreviousOutputs.add(output, mOutputs.valueFor(output));
+            }
+        }
+
+        checkA2dpSuspend();
+        checkOutputForAllStrategies();
+        // outputs must be closed after checkOutputForAllStrategies() is executed
+        for (size_t i = 0; i < mBatchClosedOutputs.size(); i++) {
+            // close unused outputs after device disconnection
+            if (mOutputs.indexOfKey(mBatchClosedOutputs[i]) >= 0) {
+                closeOutput(mBatchClosedOutputs[i]);
+            }
+        }
+        for (size_t i = 0; i < mBatchProbedOutputs.size(); i++) {
+            // close direct outputs that have been opened by checkOutputsForDevice() to query
+            // dynamic parameters
+            AudioOutputDescriptor *desc = mOutputs.valueFor(mBatchProbedOutputs[i]);
+            if (desc != NULL && ((desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) != 0) &&
+                    (desc->mDirectOpenCount == 0)) {
+                closeOutput(mBatchProbedOutputs[i]);
+            }
+        }
+
+        updateDevicesAndOutputs();
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            audio_io_handle_t output = mOutputs.keyAt(i);
+            audio_devices_t newDevice = getNewDevice(output, true /*fromCache*/);
+            // a single connection change forces the routing of all outputs, as it always did.
+            // Within a batch, only force the routing of outputs opened during the transaction
+            // or whose device changed: a device connected and disconnected in the same
+            // transaction cancels out.
+            // Do not force device change on duplicated output because if device is 0, it will
+            // also force a device 0 for the two outputs it is duplicated to which may override
+            // a valid device selection on those outputs.
+            ssize_t index = mBatchOutputDevices.indexOfKey(output);
+            bool changed = (mBatchOutputChanges <= 1) || (index < 0) ||
+                    (mBatchOutputDevices.valueAt(index) != newDevice);
+            setOutputDevice(output,
+                            newDevice,
+                            changed && !mOutputs.valueAt(i)->isDuplicated(),
+                            0);
+        }
+    }
+
+    if (mBatchInputDevicesChanged) {
+        closeAllInputs();
+    }
+
+    mBatchPreviousOutputs.clear();
+    mBatchOutputDevices.clear();
+    mBatchClosedOutputs.clear();
+    mBatchProbedOutputs.clear();
+    return NO_ERROR;
+}
+
+status_t AudioPolicyManagerBase::updateDeviceConnectionState(audio_devices_t device,
+                                                  AudioSystem::device_connection_state state,
+                                                  const char *device_address)
 {
     // device_address can be NULL and should be handled as an empty string in this case,
     // and it is not checked by AudioPolicyInterfaceImpl.cpp
@@ -85,9 +207,6 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             return BAD_VALUE;
         }
 
-        // save a copy of the opened output descriptors before any output is opened or closed
-        // by checkOutputsForDevice(). This will be needed by checkOutputForAllStrategies()
-        mPreviousOutputs = mOutputs;
         String8 paramStr;
         switch (state)
         {
@@ -116,6 +235,10 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
                   outputs.size());
             // register new device as available
             mAvailableOutputDevices = (audio_devices_t)(mAvailableOutputDevices | device);
+            // direct outputs opened to query dynamic parameters are closed on commit if unused
+            for (size_t i = 0; i < outputs.size(); i++) {
+                mBatchProbedOutputs.add(outputs[i]);
+            }
 
             if (mHasA2dp && audio_is_a2dp_out_device(device)) {
                 // handle A2DP device connection
@@ -141,6 +264,9 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             // remove device from available output devices
             mAvailableOutputDevices = (audio_devices_t)(mAvailableOutputDevices & ~device);
             checkOutputsForDevice(device, state, outputs, paramStr);
+            for (size_t i = 0; i < outputs.size(); i++) {
+                mBatchClosedOutputs.add(outputs[i]);
+            }
 
             if (mHasA2dp && audio_is_a2dp_out_device(device)) {
                 // handle A2DP device disconnection
@@ -162,32 +288,8 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             return BAD_VALUE;
         }
 
-        checkA2dpSuspend();
-        checkOutputForAllStrategies();
-        // outputs must be closed after checkOutputForAllStrategies() is executed
-        if (!outputs.isEmpty()) {
-            for (size_t i = 0; i < outputs.size(); i++) {
-                AudioOutputDescriptor *desc = mOutputs.valueFor(outputs[i]);
-                // close unused outputs after device disconnection or direct outputs that have been
-                // opened by checkOutputsForDevice() to query dynamic parameters
-                if ((state == AudioSystem::DEVICE_STATE_UNAVAILABLE) ||
-                        (((desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) != 0) &&
-                         (desc->mDirectOpenCount == 0))) {
-                    closeOutput(outputs[i]);
-                }
-            }
-        }
-
-        updateDevicesAndOutputs();
-        for (size_t i = 0; i < mOutputs.size(); i++) {
-            // do not force device change on duplicated output because if device is 0, it will
-            // also force a device 0 for the two outputs it is duplicated to which may override
-            // a valid device selection on those outputs.
-            setOutputDevice(mOutputs.keyAt(i),
-                            getNewDevice(mOutputs.keyAt(i), true /*fromCache*/),
-                            !mOutputs.valueAt(i)->isDuplicated(),
-                            0);
-        }
+        mBatchOutputDevicesChanged = true;
+        mBatchOutputChanges++;
 
         return NO_ERROR;
     }  // end if is output device
@@ -238,7 +340,7 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             return BAD_VALUE;
         }
 
-        closeAllInputs();
+        mBatchInputDevicesChanged = true;
 
         return NO_ERROR;
     } // end if is input device
@@ -458,9 +560,12 @@ void AudioPolicyManagerBase::setForceUse(AudioSystem::force_use usage, AudioSyst
         break;
     }
 
-    // check for device and output changes triggered by new force usage
+    // check for device and output changes triggered by new force usage. A change of A2DP
+    // suspend state affects all strategies.
+    bool a2dpSuspended = mA2dpSuspended;
     checkA2dpSuspend();
-    checkOutputForAllStrategies();
+    checkOutputForStrategies((mA2dpSuspended != a2dpSuspended) ? STRATEGY_MASK_ALL :
+                                                                 getStrategiesForForceUse(usage));
     updateDevicesAndOutputs();
     for (size_t i = 0; i < mOutputs.size(); i++) {
         audio_io_handle_t output = mOutputs.keyAt(i);
@@ -798,6 +903,7 @@ status_t AudioPolicyManagerBase::startOutput(audio_io_handle_t output,
         // routing
         handleNotificationRoutingForStream(stream);
         if (waitMs > muteWaitMs) {
+            AudioPolicyLatency::Timer timer(AudioPolicyLatency::START_OUTPUT_WAIT);
             usleep((waitMs - muteWaitMs) * 2 * 1000);
         }
     }
@@ -1539,7 +1645,8 @@ bool AudioPolicyManagerBase::isOffloadSupported(const audio_offload_info_t& offl
 // AudioPolicyManagerBase
 // ----------------------------------------------------------------------------
 
-AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface)
+AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface,
+                                               const char *configFile)
     :
 #ifdef AUDIO_POLICY_TEST
     Thread(false),
@@ -1550,7 +1657,9 @@ AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clien
     mLimitRingtoneVolume(false), mLastVoiceVolume(-1.0f),
     mTotalEffectsCpuLoad(0), mTotalEffectsMemory(0),
     mA2dpSuspended(false), mHasA2dp(false), mHasUsb(false), mHasRemoteSubmix(false),
-    mSpeakerDrcEnabled(false)
+    mSpeakerDrcEnabled(false), mDeviceConnectionBatch(false),
+    mBatchOutputDevicesChanged(false), mBatchInputDevicesChanged(false),
+    mBatchOutputChanges(0)
 {
     mpClientInterface = clientInterface;
 
@@ -1562,7 +1671,8 @@ AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clien
     mScoDeviceAddress = String8("");
     mUsbOutCardAndDevice = String8("");
 
-    if (loadAudioPolicyConfig(AUDIO_POLICY_VENDOR_CONFIG_FILE) != NO_ERROR) {
+    if ((configFile == NULL || loadAudioPolicyConfig(configFile) != NO_ERROR) &&
+            loadAudioPolicyConfig(AUDIO_POLICY_VENDOR_CONFIG_FILE) != NO_ERROR) {
         if (loadAudioPolicyConfig(AUDIO_POLICY_CONFIG_FILE) != NO_ERROR) {
             ALOGE("could not load audio policy configuration file, setting defaults");
             defaultAudioPolicyConfig();
@@ -1846,9 +1956,15 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
     AudioOutputDescriptor *desc;
 
     if (state == AudioSystem::DEVICE_STATE_AVAILABLE) {
-        // first list already open outputs that can be routed to this device
+        // first list already open outputs that can be routed to this device. Outputs of a
+        // device disconnected earlier in the transaction are closed on commit: a device
+        // reconnected in the same transaction, e.g. a new A2DP sink, gets a new output opened
+        // with its parameters instead.
         for (size_t i = 0; i < mOutputs.size(); i++) {
             desc = mOutputs.valueAt(i);
+            if (mBatchClosedOutputs.indexOf(mOutputs.keyAt(i)) >= 0) {
+                continue;
+            }
             if (!desc->isDuplicated() && (desc->mProfile->mSupportedDevices & device)) {
                 ALOGV("checkOutputsForDevice(): adding opened output %d", mOutputs.keyAt(i));
                 outputs.add(mOutputs.keyAt(i));
@@ -1884,7 +2000,8 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
             size_t j;
             for (j = 0; j < mOutputs.size(); j++) {
                 desc = mOutputs.valueAt(j);
-                if (!desc->isDuplicated() && desc->mProfile == profile) {
+                if (!desc->isDuplicated() && desc->mProfile == profile &&
+                        mBatchClosedOutputs.indexOf(mOutputs.keyAt(j)) < 0) {
                     break;
                 }
             }
@@ -2368,12 +2485,76 @@ void AudioPolicyManagerBase::checkOutputForStrategy(routing_strategy strategy)
 
 void AudioPolicyManagerBase::checkOutputForAllStrategies()
 {
-    checkOutputForStrategy(STRATEGY_ENFORCED_AUDIBLE);
-    checkOutputForStrategy(STRATEGY_PHONE);
-    checkOutputForStrategy(STRATEGY_SONIFICATION);
-    checkOutputForStrategy(STRATEGY_SONIFICATION_RESPECTFUL);
-    checkOutputForStrategy(STRATEGY_MEDIA);
-    checkOutputForStrategy(STRATEGY_DTMF);
+    checkOutputForStrategies(STRATEGY_MASK_ALL);
+}
+
+void AudioPolicyManagerBase::checkOutputForStrategies(uint32_t strategies)
+{
+    static const routing_strategy sStrategiesByPriority[NUM_STRATEGIES] = {
+        STRATEGY_ENFORCED_AUDIBLE,
+        STRATEGY_PHONE,
+        STRATEGY_SONIFICATION,
+        STRATEGY_SONIFICATION_RESPECTFUL,
+        STRATEGY_MEDIA,
+        STRATEGY_DTMF,
+    };
+
+    // SONIFICATION_RESPECTFUL follows recent music activity, which no policy input tracks
+    strategies |= STRATEGY_MASK(STRATEGY_SONIFICATION_RESPECTFUL);
+
+    // if no output was opened or closed, a strategy keeping its device keeps its outputs
+    bool outputsChanged = (mPreviousOutputs.size() != mOutputs.size());
+    for (size_t i = 0; !outputsChanged && i < mOutputs.size(); i++) {
+        outputsChanged = (mPreviousOutputs.keyAt(i) != mOutputs.keyAt(i));
+    }
+
+    for (size_t i = 0; i < NUM_STRATEGIES; i++) {
+        routing_strategy strategy = sStrategiesByPriority[i];
+        if ((strategies & STRATEGY_MASK(strategy)) == 0) {
+            continue;
+        }
+        if (!outputsChanged &&
+                getDeviceForStrategy(strategy, true /*fromCache*/) ==
+                        getDeviceForStrategy(strategy, false /*fromCache*/)) {
+            continue;
+        }
+        checkOutputForStrategy(strategy);
+    }
+}
+
+uint32_t AudioPolicyManagerBase::getStrategiesForForceUse(AudioSystem::force_use usage)
+{
+    // strategies derived from MEDIA device selection
+    static const uint32_t kMediaDerived = STRATEGY_MASK(STRATEGY_MEDIA) |
+                                          STRATEGY_MASK(STRATEGY_SONIFICATION) |
+                                          STRATEGY_MASK(STRATEGY_SONIFICATION_RESPECTFUL) |
+                                          STRATEGY_MASK(STRATEGY_DTMF) |
+                                          STRATEGY_MASK(STRATEGY_ENFORCED_AUDIBLE);
+    // strategies derived from PHONE device selection
+    static const uint32_t kPhoneDerived = STRATEGY_MASK(STRATEGY_PHONE) |
+                                          STRATEGY_MASK(STRATEGY_DTMF) |
+                                          STRATEGY_MASK(STRATEGY_SONIFICATION) |
+                                          STRATEGY_MASK(STRATEGY_SONIFICATION_RESPECTFUL);
+
+    // must be kept in sync with getDeviceForStrategy()
+    switch (usage) {
+    case AudioSystem::FOR_COMMUNICATION:
+        return kPhoneDerived;
+    case AudioSystem::FOR_MEDIA:
+        // FORCE_NO_BT_A2DP applies to both phone and media strategies
+        return kPhoneDerived | kMediaDerived;
+    case AudioSystem::FOR_RECORD:
+        // only input device selection
+        return 0;
+    case AudioSystem::FOR_DOCK:
+        // FORCE_ANALOG_DOCK in media strategy
+        return kMediaDerived;
+    case AudioSystem::FOR_SYSTEM:
+        // FORCE_SYSTEM_ENFORCED
+        return STRATEGY_MASK(STRATEGY_ENFORCED_AUDIBLE);
+    default:
+        return 0;
+    }
 }
 
 audio_io_handle_t AudioPolicyManagerBase::getA2dpOutput()
@@ -2817,6 +2998,7 @@ uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor
     // wait for the PCM output buffers to empty before proceeding with the rest of the command
     if (muteWaitMs > delayMs) {
         muteWaitMs -= delayMs;
+        AudioPolicyLatency::Timer timer(AudioPolicyLatency::MUTE_WAIT);
         usleep(muteWaitMs * 1000);
         return muteWaitMs;
     }
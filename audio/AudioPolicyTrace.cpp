@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyTrace"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <utils/AndroidThreads.h>
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include "AudioPolicyLatency.h"
+#include "AudioPolicyTrace.h"
+
+namespace android_audio_legacy {
+    using android::String8;
+
+AudioPolicyTrace::AudioPolicyTrace(size_t numRecords)
+    : mNextSeq(0)
+{
+    size_t size = 1;
+    while (size < numRecords) {
+        size <<= 1;
+    }
+    mRecords = (audio_policy_trace_record *)calloc(size, sizeof(audio_policy_trace_record));
+    mMask = (mRecords != NULL) ? size - 1 : 0;
+}
+
+AudioPolicyTrace::~AudioPolicyTrace()
+{
+    free(mRecords);
+}
+
+AudioPolicyTrace *AudioPolicyTrace::create()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get(AUDIO_POLICY_TRACE_PROPERTY, value, "0");
+    if (strcmp(value, "1") != 0 && strcasecmp(value, "true") != 0) {
+        return NULL;
+    }
+    AudioPolicyTrace *trace = new AudioPolicyTrace();
+    if (trace->mRecords == NULL) {
+        ALOGE("could not allocate audio policy trace");
+        delete trace;
+        return NULL;
+    }
+    ALOGI("audio policy trace enabled, %u records", trace->mMask + 1);
+    return trace;
+}
+
+void AudioPolicyTrace::record(event e, nsecs_t start, nsecs_t end, const int32_t *args,
+                              int32_t result, const char *address)
+{
+    if (mRecords == NULL) {
+        return;
+    }
+    int32_t seq = android_atomic_inc(&mNextSeq);
+    audio_policy_trace_record *r = &mRecords[(uint32_t)seq & mMask];
+
+    // mark the slot invalid while it is being written so that a concurrent snapshot()
+    // does not return a torn record
+    android_atomic_release_store(0, &r->seq);
+    // the release store only orders the writes before it: keep the payload writes below
+    // from becoming visible before the slot is marked invalid
+    android_memory_barrier();
+    r->timestamp = start;
+    r->duration = end - start;
+    r->tid = androidGetTid();
+    r->event = (uint16_t)e;
+    r->reserved = 0;
+    r->result = result;
+    memcpy(r->args, args, sizeof(r->args));
+    if (address != NULL) {
+        strncpy(r->address, address, AUDIO_POLICY_TRACE_ADDRESS_LEN - 1);
+        r->address[AUDIO_POLICY_TRACE_ADDRESS_LEN - 1] = '\0';
+    } else {
+        r->address[0] = '\0';
+    }
+    android_atomic_release_store(seq + 1, &r->seq);
+}
+
+AudioPolicyTrace::Scope::~Scope()
+{
+    nsecs_t end = systemTime();
+    AudioPolicyLatency::record((AudioPolicyLatency::histogram)mEvent, end - mStart);
+    if (mTrace != NULL) {
+        mTrace->record(mEvent, mStart, end, mArgs, mResult, mAddress);
+    }
+}
+
+void AudioPolicyTrace::snapshot(Vector<audio_policy_trace_record>& records) const
+{
+    records.clear();
+    if (mRecords == NULL) {
+        return;
+    }
+    uint32_t size = mMask + 1;
+    uint32_t next = (uint32_t)android_atomic_acquire_load(&mNextSeq);
+    uint32_t first = (next > size) ? next - size : 0;
+
+    for (uint32_t seq = first; seq != next; seq++) {
+        const audio_policy_trace_record *r = &mRecords[seq & mMask];
+        audio_policy_trace_record copy;
+
+        int32_t before = android_atomic_acquire_load(&r->seq);
+        memcpy(&copy, r, sizeof(copy));
+        // keep the payload loads above from being satisfied after the second seq load
+        android_memory_barrier();
+        int32_t after = android_atomic_acquire_load(&r->seq);
+        // skip slots being written or already overwritten by a newer call
+        if (before != after || (uint32_t)before != seq + 1) {
+            continue;
+        }
+        records.add(copy);
+    }
+}
+
+const char *AudioPolicyTrace::eventName(uint32_t e)
+{
+    static const char * const sNames[NUM_EVENTS] = {
+        "setDeviceConnectionState",
+        "setPhoneState",
+        "setForceUse",
+        "getOutput",
+        "startOutput",
+        "stopOutput",
+        "releaseOutput",
+        "getInput",
+        "startInput",
+        "stopInput",
+        "releaseInput",
+        "initStreamVolume",
+        "setStreamVolumeIndex",
+        "setCanMuteEnforcedAudible",
+    };
+    if (e >= NUM_EVENTS) {
+        return "unknown";
+    }
+    return sNames[e];
+}
+
+status_t AudioPolicyTrace::dump(int fd, size_t maxRecords) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+    Vector<audio_policy_trace_record> records;
+
+    snapshot(records);
+    size_t first = (records.size() > maxRecords) ? records.size() - maxRecords : 0;
+
+    snprintf(buffer, SIZE, "\nAudio policy trace: %zu calls recorded, last %zu:\n",
+             (size_t)(uint32_t)mNextSeq, records.size() - first);
+    result.append(buffer);
+    snprintf(buffer, SIZE, " %8s %12s %6s %-26s %-50s %8s %8s\n",
+             "Seq", "Time ms", "Tid", "Call", "Args", "Result", "Dur us");
+    result.append(buffer);
+    for (size_t i = first; i < records.size(); i++) {
+        const audio_policy_trace_record& r = records[i];
+        char args[64];
+        snprintf(args, sizeof(args), "%d %d %d %d %d %s",
+                 r.args[0], r.args[1], r.args[2], r.args[3], r.args[4], r.address);
+        snprintf(buffer, SIZE, " %8d %12lld %6d %-26s %-50s %8d %8lld\n",
+                 r.seq - 1, (long long)ns2ms(r.timestamp), r.tid, eventName(r.event), args,
+                 r.result, (long long)ns2us(r.duration));
+        result.append(buffer);
+    }
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+status_t AudioPolicyTrace::writeRecords(int fd) const
+{
+    Vector<audio_policy_trace_record> records;
+    snapshot(records);
+
+    struct audio_policy_trace_header header;
+    header.magic = AUDIO_POLICY_TRACE_MAGIC;
+    header.version = AUDIO_POLICY_TRACE_VERSION;
+    header.recordSize = sizeof(audio_policy_trace_record);
+    header.numRecords = records.size();
+
+    size_t size = records.size() * sizeof(audio_policy_trace_record);
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+            (size != 0 && write(fd, records.array(), size) != (ssize_t)size)) {
+        return -errno;
+    }
+    return NO_ERROR;
+}
+
+status_t AudioPolicyTrace::readRecords(int fd, Vector<audio_policy_trace_record>& records)
+{
+    struct audio_policy_trace_header header;
+
+    records.clear();
+    if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+            header.magic != AUDIO_POLICY_TRACE_MAGIC) {
+        return BAD_VALUE;
+    }
+    if (header.version != AUDIO_POLICY_TRACE_VERSION ||
+            header.recordSize != sizeof(audio_policy_trace_record)) {
+        ALOGE("unsupported trace version %u record size %u", header.version, header.recordSize);
+        return BAD_VALUE;
+    }
+    for (uint32_t i = 0; i < header.numRecords; i++) {
+        audio_policy_trace_record r;
+        if (read(fd, &r, sizeof(r)) != (ssize_t)sizeof(r)) {
+            return NOT_ENOUGH_DATA;
+        }
+        r.address[AUDIO_POLICY_TRACE_ADDRESS_LEN - 1] = '\0';
+        records.add(r);
+    }
+    return NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYTRACE_H
+#define ANDROID_AUDIOPOLICYTRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <hardware_legacy/AudioSystemLegacy.h>
+
+namespace android_audio_legacy {
+    using android::Vector;
+
+// ----------------------------------------------------------------------------
+
+// Property enabling the trace when the policy is created: "1" or "true"
+#define AUDIO_POLICY_TRACE_PROPERTY "audio.policy.trace"
+// Property naming a file the binary trace is written to each time the policy is dumped
+#define AUDIO_POLICY_TRACE_FILE_PROPERTY "audio.policy.trace.file"
+
+#define AUDIO_POLICY_TRACE_MAGIC 0x52545041 // "APTR"
+#define AUDIO_POLICY_TRACE_VERSION 1
+#define AUDIO_POLICY_TRACE_ADDRESS_LEN 20   // same as MAX_DEVICE_ADDRESS_LEN
+
+// Binary trace file header, followed by numRecords audio_policy_trace_record in call order.
+struct audio_policy_trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t numRecords;
+};
+
+// One policy call. The meaning of args[] depends on the event, see AudioPolicyTrace::event.
+struct audio_policy_trace_record {
+    int64_t  timestamp;     // systemTime() when the call entered the HAL
+    int64_t  duration;      // time spent in the policy manager in ns
+    int32_t  seq;           // call sequence number + 1, 0 while the slot is being written
+    int32_t  tid;           // calling thread
+    uint16_t event;
+    uint16_t reserved;
+    int32_t  result;        // return value, 0 for calls returning void
+    int32_t  args[5];
+    char     address[AUDIO_POLICY_TRACE_ADDRESS_LEN];
+};
+
+// AudioPolicyTrace records the calls entering the legacy audio policy HAL in a fixed size
+// ring buffer so that a field session can be dumped and replayed offline by
+// audio_policy_sim. Writers claim a slot with an atomic increment and publish it by
+// storing its sequence number last: recording never takes a lock and never allocates.
+class AudioPolicyTrace
+{
+public:
+    // events recorded and their arguments
+    enum event {
+        SET_DEVICE_CONNECTION_STATE,    // device, state, address
+        SET_PHONE_STATE,                // state
+        SET_FORCE_USE,                  // usage, config
+        GET_OUTPUT,                     // stream, sampling rate, format, channel mask, flags
+        START_OUTPUT,                   // output, stream, session
+        STOP_OUTPUT,                    // output, stream, session
+        RELEASE_OUTPUT,                 // output
+        GET_INPUT,                      // source, sampling rate, format, channel mask, acoustics
+        START_INPUT,                    // input
+        STOP_INPUT,                     // input
+        RELEASE_INPUT,                  // input
+        INIT_STREAM_VOLUME,             // stream, index min, index max
+        SET_STREAM_VOLUME_INDEX,        // stream, index, device
+        SET_CAN_MUTE_ENFORCED_AUDIBLE,  // can mute
+        NUM_EVENTS
+    };
+
+    static const size_t DEFAULT_NUM_RECORDS = 2048;
+
+                AudioPolicyTrace(size_t numRecords = DEFAULT_NUM_RECORDS);
+                ~AudioPolicyTrace();
+
+    // returns a trace if enabled by AUDIO_POLICY_TRACE_PROPERTY, NULL otherwise
+    static AudioPolicyTrace *create();
+
+    void record(event e, nsecs_t start, nsecs_t end, const int32_t *args,
+                int32_t result, const char *address);
+
+    // copies the records currently in the ring in call order, skipping slots being written
+    void snapshot(Vector<audio_policy_trace_record>& records) const;
+
+    // writes the last maxRecords calls in text form
+    status_t dump(int fd, size_t maxRecords) const;
+    // writes the whole ring in binary form, readable by readRecords()
+    status_t writeRecords(int fd) const;
+    static status_t readRecords(int fd, Vector<audio_policy_trace_record>& records);
+
+    static const char *eventName(uint32_t e);
+
+    // Records one call on destruction: always in the AudioPolicyLatency histogram of the
+    // entry point and in the trace if not NULL.
+    class Scope
+    {
+    public:
+        Scope(AudioPolicyTrace *trace, event e,
+              int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0,
+              int32_t arg3 = 0, int32_t arg4 = 0, const char *address = NULL)
+            : mTrace(trace), mEvent(e), mResult(0), mAddress(address)
+        {
+            if (mTrace != NULL) {
+                mArgs[0] = arg0;
+                mArgs[1] = arg1;
+                mArgs[2] = arg2;
+                mArgs[3] = arg3;
+                mArgs[4] = arg4;
+            }
+            mStart = systemTime();
+        }
+        ~Scope();
+
+        // stores the value returned by the call and passes it through
+        int32_t result(int32_t result) { mResult = result; return result; }
+
+    private:
+        AudioPolicyTrace *mTrace;
+        event mEvent;
+        nsecs_t mStart;
+        int32_t mArgs[5];
+        int32_t mResult;
+        const char *mAddress;
+    };
+
+private:
+    AudioPolicyTrace(const AudioPolicyTrace&);
+    AudioPolicyTrace& operator=(const AudioPolicyTrace&);
+
+    audio_policy_trace_record *mRecords;
+    uint32_t mMask;                     // number of records - 1, a power of 2 minus 1
+    volatile int32_t mNextSeq;          // sequence number of the next call recorded
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYTRACE_H
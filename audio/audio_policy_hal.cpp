@@ -17,7 +17,13 @@
 #define LOG_TAG "legacy_audio_policy_hal"
 //#define LOG_NDEBUG 0
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <system/audio.h>
@@ -28,6 +34,8 @@
 #include <hardware_legacy/AudioSystemLegacy.h>
 
 #include "AudioPolicyCompatClient.h"
+#include "AudioPolicyLatency.h"
+#include "AudioPolicyTrace.h"
 
 namespace android_audio_legacy {
 
@@ -48,8 +56,12 @@ struct legacy_audio_policy {
     struct audio_policy_service_ops *aps_ops;
     AudioPolicyCompatClient *service_client;
     AudioPolicyInterface *apm;
+    AudioPolicyTrace *trace;    // NULL unless enabled by AUDIO_POLICY_TRACE_PROPERTY
 };
 
+// number of trace records printed by ap_dump()
+#define AP_DUMP_TRACE_RECORDS 100
+
 static inline struct legacy_audio_policy * to_lap(struct audio_policy *pol)
 {
     return reinterpret_cast<struct legacy_audio_policy *>(pol);
@@ -67,10 +79,12 @@ static int ap_set_device_connection_state(struct audio_policy *pol,
                                           const char *device_address)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setDeviceConnectionState(
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::SET_DEVICE_CONNECTION_STATE,
+                                  device, state, 0, 0, 0, device_address);
+    return trace.result(lap->apm->setDeviceConnectionState(
                     (AudioSystem::audio_devices)device,
                     (AudioSystem::device_connection_state)state,
-                    device_address);
+                    device_address));
 }
 
 static audio_policy_dev_state_t ap_get_device_connection_state(
@@ -79,6 +93,7 @@ static audio_policy_dev_state_t ap_get_device_connection_state(
                                             const char *device_address)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_DEVICE_CONNECTION_STATE);
     return (audio_policy_dev_state_t)lap->apm->getDeviceConnectionState(
                     (AudioSystem::audio_devices)device,
                     device_address);
@@ -87,6 +102,7 @@ static audio_policy_dev_state_t ap_get_device_connection_state(
 static void ap_set_phone_state(struct audio_policy *pol, audio_mode_t state)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::SET_PHONE_STATE, state);
     // as this is the legacy API, don't change it to use audio_mode_t instead of int
     lap->apm->setPhoneState((int) state);
 }
@@ -96,6 +112,7 @@ static void ap_set_ringer_mode(struct audio_policy *pol, uint32_t mode,
                                uint32_t mask)
 {
     // deprecated, never called
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::SET_RINGER_MODE);
 }
 
     /* force using a specific device category for the specified usage */
@@ -104,6 +121,7 @@ static void ap_set_force_use(struct audio_policy *pol,
                           audio_policy_forced_cfg_t config)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::SET_FORCE_USE, usage, config);
     lap->apm->setForceUse((AudioSystem::force_use)usage,
                           (AudioSystem::forced_config)config);
 }
@@ -114,6 +132,7 @@ static audio_policy_forced_cfg_t ap_get_force_use(
                                                audio_policy_force_use_t usage)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_FORCE_USE);
     return (audio_policy_forced_cfg_t)lap->apm->getForceUse(
                           (AudioSystem::force_use)usage);
 }
@@ -124,12 +143,15 @@ static void ap_set_can_mute_enforced_audible(struct audio_policy *pol,
                                              bool can_mute)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::SET_CAN_MUTE_ENFORCED_AUDIBLE,
+                                  can_mute);
     lap->apm->setSystemProperty("ro.camera.sound.forced", can_mute ? "0" : "1");
 }
 
 static int ap_init_check(const struct audio_policy *pol)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::INIT_CHECK);
     return lap->apm->initCheck();
 }
 
@@ -144,32 +166,39 @@ static audio_io_handle_t ap_get_output(struct audio_policy *pol,
     struct legacy_audio_policy *lap = to_lap(pol);
 
     ALOGV("%s: tid %d", __func__, gettid());
-    return lap->apm->getOutput((AudioSystem::stream_type)stream,
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::GET_OUTPUT,
+                                  stream, sampling_rate, format, channelMask, flags);
+    return trace.result(lap->apm->getOutput((AudioSystem::stream_type)stream,
                                sampling_rate, format, channelMask,
                                (AudioSystem::output_flags)flags,
-                               offloadInfo);
+                               offloadInfo));
 }
 
 static int ap_start_output(struct audio_policy *pol, audio_io_handle_t output,
                            audio_stream_type_t stream, int session)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->startOutput(output, (AudioSystem::stream_type)stream,
-                                 session);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::START_OUTPUT,
+                                  output, stream, session);
+    return trace.result(lap->apm->startOutput(output, (AudioSystem::stream_type)stream,
+                                 session));
 }
 
 static int ap_stop_output(struct audio_policy *pol, audio_io_handle_t output,
                           audio_stream_type_t stream, int session)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->stopOutput(output, (AudioSystem::stream_type)stream,
-                                session);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::STOP_OUTPUT,
+                                  output, stream, session);
+    return trace.result(lap->apm->stopOutput(output, (AudioSystem::stream_type)stream,
+                                session));
 }
 
 static void ap_release_output(struct audio_policy *pol,
                               audio_io_handle_t output)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::RELEASE_OUTPUT, output);
     lap->apm->releaseOutput(output);
 }
 
@@ -180,25 +209,30 @@ static audio_io_handle_t ap_get_input(struct audio_policy *pol, audio_source_t i
                                       audio_in_acoustics_t acoustics)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->getInput((int) inputSource, sampling_rate, format, channelMask,
-                              (AudioSystem::audio_in_acoustics)acoustics);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::GET_INPUT,
+                                  inputSource, sampling_rate, format, channelMask, acoustics);
+    return trace.result(lap->apm->getInput((int) inputSource, sampling_rate, format, channelMask,
+                              (AudioSystem::audio_in_acoustics)acoustics));
 }
 
 static int ap_start_input(struct audio_policy *pol, audio_io_handle_t input)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->startInput(input);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::START_INPUT, input);
+    return trace.result(lap->apm->startInput(input));
 }
 
 static int ap_stop_input(struct audio_policy *pol, audio_io_handle_t input)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->stopInput(input);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::STOP_INPUT, input);
+    return trace.result(lap->apm->stopInput(input));
 }
 
 static void ap_release_input(struct audio_policy *pol, audio_io_handle_t input)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::RELEASE_INPUT, input);
     lap->apm->releaseInput(input);
 }
 
@@ -207,6 +241,8 @@ static void ap_init_stream_volume(struct audio_policy *pol,
                                   int index_max)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::INIT_STREAM_VOLUME,
+                                  stream, index_min, index_max);
     lap->apm->initStreamVolume((AudioSystem::stream_type)stream, index_min,
                                index_max);
 }
@@ -216,9 +252,11 @@ static int ap_set_stream_volume_index(struct audio_policy *pol,
                                       int index)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::SET_STREAM_VOLUME_INDEX,
+                                  stream, index, AUDIO_DEVICE_OUT_DEFAULT);
+    return trace.result(lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
-                                          AUDIO_DEVICE_OUT_DEFAULT);
+                                          AUDIO_DEVICE_OUT_DEFAULT));
 }
 
 static int ap_get_stream_volume_index(const struct audio_policy *pol,
@@ -226,6 +264,7 @@ static int ap_get_stream_volume_index(const struct audio_policy *pol,
                                       int *index)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_STREAM_VOLUME_INDEX);
     return lap->apm->getStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
                                           AUDIO_DEVICE_OUT_DEFAULT);
@@ -237,9 +276,11 @@ static int ap_set_stream_volume_index_for_device(struct audio_policy *pol,
                                       audio_devices_t device)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
+    AudioPolicyTrace::Scope trace(lap->trace, AudioPolicyTrace::SET_STREAM_VOLUME_INDEX,
+                                  stream, index, device);
+    return trace.result(lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
-                                          device);
+                                          device));
 }
 
 static int ap_get_stream_volume_index_for_device(const struct audio_policy *pol,
@@ -248,6 +289,7 @@ static int ap_get_stream_volume_index_for_device(const struct audio_policy *pol,
                                       audio_devices_t device)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_STREAM_VOLUME_INDEX);
     return lap->apm->getStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
                                           device);
@@ -257,6 +299,7 @@ static uint32_t ap_get_strategy_for_stream(const struct audio_policy *pol,
                                            audio_stream_type_t stream)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_STRATEGY_FOR_STREAM);
     return lap->apm->getStrategyForStream((AudioSystem::stream_type)stream);
 }
 
@@ -264,6 +307,7 @@ static audio_devices_t ap_get_devices_for_stream(const struct audio_policy *pol,
                                        audio_stream_type_t stream)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_DEVICES_FOR_STREAM);
     return lap->apm->getDevicesForStream((AudioSystem::stream_type)stream);
 }
 
@@ -271,6 +315,7 @@ static audio_io_handle_t ap_get_output_for_effect(struct audio_policy *pol,
                                             const struct effect_descriptor_s *desc)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::GET_OUTPUT_FOR_EFFECT);
     return lap->apm->getOutputForEffect(desc);
 }
 
@@ -282,18 +327,21 @@ static int ap_register_effect(struct audio_policy *pol,
                               int id)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::REGISTER_EFFECT);
     return lap->apm->registerEffect(desc, io, strategy, session, id);
 }
 
 static int ap_unregister_effect(struct audio_policy *pol, int id)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::UNREGISTER_EFFECT);
     return lap->apm->unregisterEffect(id);
 }
 
 static int ap_set_effect_enabled(struct audio_policy *pol, int id, bool enabled)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::SET_EFFECT_ENABLED);
     return lap->apm->setEffectEnabled(id, enabled);
 }
 
@@ -301,6 +349,7 @@ static bool ap_is_stream_active(const struct audio_policy *pol, audio_stream_typ
                                 uint32_t in_past_ms)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::IS_STREAM_ACTIVE);
     return lap->apm->isStreamActive((int) stream, in_past_ms);
 }
 
@@ -308,25 +357,45 @@ static bool ap_is_stream_active_remotely(const struct audio_policy *pol, audio_s
                                 uint32_t in_past_ms)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::IS_STREAM_ACTIVE_REMOTELY);
     return lap->apm->isStreamActiveRemotely((int) stream, in_past_ms);
 }
 
 static bool ap_is_source_active(const struct audio_policy *pol, audio_source_t source)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::IS_SOURCE_ACTIVE);
     return lap->apm->isSourceActive(source);
 }
 
 static int ap_dump(const struct audio_policy *pol, int fd)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->dump(fd);
+    int ret = lap->apm->dump(fd);
+
+    AudioPolicyLatency::dump(fd);
+    if (lap->trace != NULL) {
+        lap->trace->dump(fd, AP_DUMP_TRACE_RECORDS);
+
+        char path[PROPERTY_VALUE_MAX];
+        if (property_get(AUDIO_POLICY_TRACE_FILE_PROPERTY, path, NULL) > 0) {
+            int traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+            if (traceFd < 0 || lap->trace->writeRecords(traceFd) != NO_ERROR) {
+                ALOGW("could not write audio policy trace to %s: %s", path, strerror(errno));
+            }
+            if (traceFd >= 0) {
+                close(traceFd);
+            }
+        }
+    }
+    return ret;
 }
 
 static bool ap_is_offload_supported(const struct audio_policy *pol,
                                     const audio_offload_info_t *info)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+    AudioPolicyLatency::Timer timer(AudioPolicyLatency::IS_OFFLOAD_SUPPORTED);
     return lap->apm->isOffloadSupported(*info);
 }
 
@@ -394,6 +463,8 @@ static int create_legacy_ap(const struct audio_policy_device *device,
         goto err_create_apm;
     }
 
+    lap->trace = AudioPolicyTrace::create();
+
     *ap = &lap->policy;
     return 0;
 
@@ -415,6 +486,8 @@ static int destroy_legacy_ap(const struct audio_policy_device *ap_dev,
 
     if (lap->apm)
         destroyAudioPolicyManager(lap->apm);
+    if (lap->trace)
+        delete lap->trace;
     if (lap->service_client)
         delete lap->service_client;
     free(lap);
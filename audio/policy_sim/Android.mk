@@ -0,0 +1,48 @@
+# Copyright 2014 The Android Open Source Project
+
+# audio_policy_sim: replays scripted policy events or recorded policy traces through
+# AudioPolicyManagerBase against a fake AudioFlinger client and reports per API
+# latency and allocations.
+# Built for the device and, on Linux hosts, for the build machine.
+
+LOCAL_PATH := $(call my-dir)
+
+audio_policy_sim_src_files := \
+    ../AudioPolicyLatency.cpp \
+    ../AudioPolicyManagerBase.cpp \
+    ../AudioPolicyTrace.cpp \
+    FakeAudioPolicyClient.cpp \
+    audio_policy_sim.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(audio_policy_sim_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := libmedia_helper
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    libutils \
+    liblog
+LOCAL_MODULE := audio_policy_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wno-unused-parameter
+
+include $(BUILD_EXECUTABLE)
+
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(audio_policy_sim_src_files)
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := \
+    libmedia_helper \
+    libutils \
+    libcutils \
+    liblog
+LOCAL_LDLIBS := -lpthread -lrt
+LOCAL_MODULE := audio_policy_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wno-unused-parameter
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
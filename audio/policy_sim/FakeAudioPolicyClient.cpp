@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FakeAudioPolicyClient"
+//#define LOG_NDEBUG 0
+
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include "FakeAudioPolicyClient.h"
+
+namespace android_audio_legacy {
+
+// latency reported for every output opened: a typical primary output mixer buffer
+#define FAKE_OUTPUT_LATENCY_MS 20
+
+FakeAudioPolicyClient::FakeAudioPolicyClient()
+    : mNextHandle(1)
+{
+    resetCallCounts();
+}
+
+void FakeAudioPolicyClient::resetCallCounts()
+{
+    memset(mCallCount, 0, sizeof(mCallCount));
+}
+
+const char *FakeAudioPolicyClient::callName(call_type type)
+{
+    static const char * const sNames[NUM_CALL_TYPES] = {
+        "loadHwModule",
+        "openOutput",
+        "openDuplicateOutput",
+        "closeOutput",
+        "suspendOutput",
+        "restoreOutput",
+        "openInput",
+        "closeInput",
+        "setStreamVolume",
+        "invalidateStream",
+        "setParameters",
+        "getParameters",
+        "startTone",
+        "stopTone",
+        "setVoiceVolume",
+        "moveEffects",
+    };
+    if (type < 0 || type >= NUM_CALL_TYPES) {
+        return "unknown";
+    }
+    return sNames[type];
+}
+
+audio_module_handle_t FakeAudioPolicyClient::loadHwModule(const char *name)
+{
+    mCallCount[CALL_LOAD_HW_MODULE]++;
+    ALOGV("loadHwModule() %s -> %d", name, mNextHandle);
+    return mNextHandle++;
+}
+
+audio_io_handle_t FakeAudioPolicyClient::openOutput(audio_module_handle_t module,
+                                                    audio_devices_t *pDevices,
+                                                    uint32_t *pSamplingRate,
+                                                    audio_format_t *pFormat,
+                                                    audio_channel_mask_t *pChannelMask,
+                                                    uint32_t *pLatencyMs,
+                                                    audio_output_flags_t flags,
+                                                    const audio_offload_info_t *offloadInfo)
+{
+    mCallCount[CALL_OPEN_OUTPUT]++;
+    // report the configuration a HAL would pick when the policy leaves it open
+    if (pSamplingRate != NULL && *pSamplingRate == 0) {
+        *pSamplingRate = 44100;
+    }
+    if (pFormat != NULL && *pFormat == AUDIO_FORMAT_DEFAULT) {
+        *pFormat = AUDIO_FORMAT_PCM_16_BIT;
+    }
+    if (pChannelMask != NULL && *pChannelMask == 0) {
+        *pChannelMask = AUDIO_CHANNEL_OUT_STEREO;
+    }
+    if (pLatencyMs != NULL) {
+        *pLatencyMs = FAKE_OUTPUT_LATENCY_MS;
+    }
+    ALOGV("openOutput() module %d devices %08x flags %x -> %d",
+          module, pDevices != NULL ? *pDevices : 0, flags, mNextHandle);
+    return mNextHandle++;
+}
+
+audio_io_handle_t FakeAudioPolicyClient::openDuplicateOutput(audio_io_handle_t output1,
+                                                             audio_io_handle_t output2)
+{
+    mCallCount[CALL_OPEN_DUPLICATE_OUTPUT]++;
+    return mNextHandle++;
+}
+
+status_t FakeAudioPolicyClient::closeOutput(audio_io_handle_t output)
+{
+    mCallCount[CALL_CLOSE_OUTPUT]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::suspendOutput(audio_io_handle_t output)
+{
+    mCallCount[CALL_SUSPEND_OUTPUT]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::restoreOutput(audio_io_handle_t output)
+{
+    mCallCount[CALL_RESTORE_OUTPUT]++;
+    return NO_ERROR;
+}
+
+audio_io_handle_t FakeAudioPolicyClient::openInput(audio_module_handle_t module,
+                                                   audio_devices_t *pDevices,
+                                                   uint32_t *pSamplingRate,
+                                                   audio_format_t *pFormat,
+                                                   audio_channel_mask_t *pChannelMask)
+{
+    mCallCount[CALL_OPEN_INPUT]++;
+    return mNextHandle++;
+}
+
+status_t FakeAudioPolicyClient::closeInput(audio_io_handle_t input)
+{
+    mCallCount[CALL_CLOSE_INPUT]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::setStreamVolume(AudioSystem::stream_type stream,
+                                                float volume,
+                                                audio_io_handle_t output,
+                                                int delayMs)
+{
+    mCallCount[CALL_SET_STREAM_VOLUME]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::invalidateStream(AudioSystem::stream_type stream)
+{
+    mCallCount[CALL_INVALIDATE_STREAM]++;
+    return NO_ERROR;
+}
+
+void FakeAudioPolicyClient::setParameters(audio_io_handle_t ioHandle,
+                                          const String8& keyValuePairs,
+                                          int delayMs)
+{
+    mCallCount[CALL_SET_PARAMETERS]++;
+    ALOGV("setParameters() io %d %s delay %d", ioHandle, keyValuePairs.string(), delayMs);
+}
+
+String8 FakeAudioPolicyClient::getParameters(audio_io_handle_t ioHandle, const String8& keys)
+{
+    mCallCount[CALL_GET_PARAMETERS]++;
+    return String8("");
+}
+
+status_t FakeAudioPolicyClient::startTone(ToneGenerator::tone_type tone,
+                                          AudioSystem::stream_type stream)
+{
+    mCallCount[CALL_START_TONE]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::stopTone()
+{
+    mCallCount[CALL_STOP_TONE]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::setVoiceVolume(float volume, int delayMs)
+{
+    mCallCount[CALL_SET_VOICE_VOLUME]++;
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::moveEffects(int session,
+                                            audio_io_handle_t srcOutput,
+                                            audio_io_handle_t dstOutput)
+{
+    mCallCount[CALL_MOVE_EFFECTS]++;
+    return NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FAKEAUDIOPOLICYCLIENT_H
+#define ANDROID_FAKEAUDIOPOLICYCLIENT_H
+
+#include <stdint.h>
+
+#include <hardware_legacy/AudioPolicyInterface.h>
+
+namespace android_audio_legacy {
+
+// AudioPolicyClientInterface implementation standing in for AudioFlinger when the policy
+// manager runs off device. Every call succeeds immediately; handles are allocated from
+// a counter and each kind of call is counted so that the simulator can report how much
+// work a scripted event caused (routing commands, stream invalidations...).
+class FakeAudioPolicyClient : public AudioPolicyClientInterface {
+public:
+    enum call_type {
+        CALL_LOAD_HW_MODULE,
+        CALL_OPEN_OUTPUT,
+        CALL_OPEN_DUPLICATE_OUTPUT,
+        CALL_CLOSE_OUTPUT,
+        CALL_SUSPEND_OUTPUT,
+        CALL_RESTORE_OUTPUT,
+        CALL_OPEN_INPUT,
+        CALL_CLOSE_INPUT,
+        CALL_SET_STREAM_VOLUME,
+        CALL_INVALIDATE_STREAM,
+        CALL_SET_PARAMETERS,
+        CALL_GET_PARAMETERS,
+        CALL_START_TONE,
+        CALL_STOP_TONE,
+        CALL_SET_VOICE_VOLUME,
+        CALL_MOVE_EFFECTS,
+        NUM_CALL_TYPES
+    };
+
+                FakeAudioPolicyClient();
+    virtual     ~FakeAudioPolicyClient() {}
+
+    virtual audio_module_handle_t loadHwModule(const char *name);
+
+    virtual audio_io_handle_t openOutput(audio_module_handle_t module,
+                                         audio_devices_t *pDevices,
+                                         uint32_t *pSamplingRate,
+                                         audio_format_t *pFormat,
+                                         audio_channel_mask_t *pChannelMask,
+                                         uint32_t *pLatencyMs,
+                                         audio_output_flags_t flags,
+                                         const audio_offload_info_t *offloadInfo = NULL);
+    virtual audio_io_handle_t openDuplicateOutput(audio_io_handle_t output1,
+                                                  audio_io_handle_t output2);
+    virtual status_t closeOutput(audio_io_handle_t output);
+    virtual status_t suspendOutput(audio_io_handle_t output);
+    virtual status_t restoreOutput(audio_io_handle_t output);
+    virtual audio_io_handle_t openInput(audio_module_handle_t module,
+                                        audio_devices_t *pDevices,
+                                        uint32_t *pSamplingRate,
+                                        audio_format_t *pFormat,
+                                        audio_channel_mask_t *pChannelMask);
+    virtual status_t closeInput(audio_io_handle_t input);
+    virtual status_t setStreamVolume(AudioSystem::stream_type stream, float volume,
+                                     audio_io_handle_t output, int delayMs = 0);
+    virtual status_t invalidateStream(AudioSystem::stream_type stream);
+    virtual void setParameters(audio_io_handle_t ioHandle, const String8& keyValuePairs,
+                               int delayMs = 0);
+    virtual String8 getParameters(audio_io_handle_t ioHandle, const String8& keys);
+    virtual status_t startTone(ToneGenerator::tone_type tone, AudioSystem::stream_type stream);
+    virtual status_t stopTone();
+    virtual status_t setVoiceVolume(float volume, int delayMs = 0);
+    virtual status_t moveEffects(int session,
+                                 audio_io_handle_t srcOutput,
+                                 audio_io_handle_t dstOutput);
+
+    uint32_t callCount(call_type type) const { return mCallCount[type]; }
+    void resetCallCounts();
+    static const char *callName(call_type type);
+
+private:
+    int mNextHandle;        // next module or I/O handle returned
+    uint32_t mCallCount[NUM_CALL_TYPES];
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_FAKEAUDIOPOLICYCLIENT_H
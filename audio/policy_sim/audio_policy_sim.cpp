@@ -0,0 +1,653 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// audio_policy_sim: runs AudioPolicyManagerBase against FakeAudioPolicyClient, replays
+// a scripted sequence of policy events and reports per API latency percentiles, heap
+// allocations and the calls the policy made to its client.
+//
+// Script syntax, one event per line, '#' starts a comment:
+//   connect <devices> [address]        setDeviceConnectionState(AVAILABLE)
+//   disconnect <devices> [address]     setDeviceConnectionState(UNAVAILABLE)
+//   phone_state <mode>                 setPhoneState()
+//   force_use <usage> <config>         setForceUse()
+//   get_output <stream> [flags]        getOutput(), handle remembered per stream
+//   start_output <stream>              startOutput() on the remembered handle
+//   stop_output <stream>               stopOutput() on the remembered handle
+//   release_output <stream>            releaseOutput() on the remembered handle
+//   init_volume <stream> <min> <max>   initStreamVolume()
+//   volume <stream> <index> [devices]  setStreamVolumeIndex()
+//   begin_connections                  beginDeviceConnectionChanges()
+//   commit_connections                 commitDeviceConnectionChanges()
+//   reconnect <devices> [address]      setDeviceConnectionStates(UNAVAILABLE, AVAILABLE)
+// <devices> is a number or a '|' separated list of AUDIO_DEVICE_xxx names as used in
+// audio_policy.conf. All other arguments are numbers.
+// When the script is replayed several times (-n) it must leave the policy in the state
+// it started from (e.g. disconnect every device it connects).
+//
+// With -t the input is instead a binary trace recorded by the audio policy HAL (see
+// AudioPolicyTrace.h). Output and input handles are mapped from the recorded to the
+// replayed ones and each call result is compared with the recorded one. With -r the
+// calls are issued at the recorded time intervals, otherwise back to back.
+
+#define LOG_TAG "audio_policy_sim"
+//#define LOG_NDEBUG 0
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utils/KeyedVector.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <hardware_legacy/AudioPolicyManagerBase.h>
+
+#include "AudioPolicyLatency.h"
+#include "AudioPolicyTrace.h"
+#include "FakeAudioPolicyClient.h"
+
+// Heap allocations made through operator new while an event is processed. Allocations done
+// directly with malloc() (SharedBuffer backing Vector and String8) are not included.
+static uint64_t sAllocCount;
+static uint64_t sAllocBytes;
+
+void *operator new(size_t size)
+{
+    sAllocCount++;
+    sAllocBytes += size;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    free(p);
+}
+
+namespace android_audio_legacy {
+
+// Exposes the audio_policy.conf device name parser to the script reader.
+class SimAudioPolicyManager : public AudioPolicyManagerBase
+{
+public:
+                SimAudioPolicyManager(AudioPolicyClientInterface *clientInterface,
+                                      const char *configFile)
+                : AudioPolicyManagerBase(clientInterface, configFile) {}
+        virtual ~SimAudioPolicyManager() {}
+
+        static audio_devices_t parseDevices(const char *devices)
+        {
+            char *end;
+            unsigned long value = strtoul(devices, &end, 0);
+            if (*end == '\0') {
+                return (audio_devices_t)value;
+            }
+            char *names = strdup(devices);
+            audio_devices_t device = parseDeviceNames(names);
+            free(names);
+            return device;
+        }
+};
+
+enum sim_event_type {
+    SIM_CONNECT,
+    SIM_DISCONNECT,
+    SIM_PHONE_STATE,
+    SIM_FORCE_USE,
+    SIM_GET_OUTPUT,
+    SIM_START_OUTPUT,
+    SIM_STOP_OUTPUT,
+    SIM_RELEASE_OUTPUT,
+    SIM_INIT_VOLUME,
+    SIM_SET_VOLUME,
+    SIM_BEGIN_CONNECTIONS,
+    SIM_COMMIT_CONNECTIONS,
+    SIM_RECONNECT,
+    SIM_NUM_EVENT_TYPES
+};
+
+static const struct {
+    const char *keyword;
+    int minArgs;
+    int maxArgs;
+} sEventSyntax[SIM_NUM_EVENT_TYPES] = {
+    { "connect",            1, 2 },
+    { "disconnect",         1, 2 },
+    { "phone_state",        1, 1 },
+    { "force_use",          2, 2 },
+    { "get_output",         1, 2 },
+    { "start_output",       1, 1 },
+    { "stop_output",        1, 1 },
+    { "release_output",     1, 1 },
+    { "init_volume",        3, 3 },
+    { "volume",             2, 3 },
+    { "begin_connections",  0, 0 },
+    { "commit_connections", 0, 0 },
+    { "reconnect",          1, 2 },
+};
+
+struct SimEvent {
+    sim_event_type mType;
+    int mArgs[3];
+    char mAddress[MAX_DEVICE_ADDRESS_LEN];
+    int mLine;
+};
+
+struct SimEventStats {
+    SimEventStats() : mAllocCount(0), mAllocBytes(0), mErrors(0) {}
+
+    Vector<nsecs_t> mLatencies;
+    uint64_t mAllocCount;
+    uint64_t mAllocBytes;
+    uint32_t mErrors;       // script: calls returning an error, trace: results not matching
+};
+
+class AudioPolicySimulator
+{
+public:
+    AudioPolicySimulator(const char *configFile, bool verbose)
+        : mManager(&mClient, configFile), mVerbose(verbose)
+    {
+        for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+            mStreamOutputs[i] = 0;
+        }
+    }
+
+    status_t loadScript(const char *path);
+    status_t loadTrace(const char *path);
+    void run(int iterations);
+    void replay(int iterations, bool realTime);
+    void report();
+
+private:
+    status_t parseLine(char *line, int lineNumber);
+    status_t dispatch(const SimEvent& event);
+    bool replayRecord(const audio_policy_trace_record& record);
+
+    FakeAudioPolicyClient mClient;
+    SimAudioPolicyManager mManager;
+    bool mVerbose;
+    Vector<SimEvent> mEvents;
+    audio_io_handle_t mStreamOutputs[AudioSystem::NUM_STREAM_TYPES];
+    SimEventStats mStats[SIM_NUM_EVENT_TYPES];
+
+    Vector<audio_policy_trace_record> mRecords;
+    // recorded I/O handle -> handle returned by the replayed getOutput()/getInput()
+    DefaultKeyedVector<int32_t, audio_io_handle_t> mOutputMap;
+    DefaultKeyedVector<int32_t, audio_io_handle_t> mInputMap;
+    SimEventStats mTraceStats[AudioPolicyTrace::NUM_EVENTS];
+    SimEventStats mRecordedStats[AudioPolicyTrace::NUM_EVENTS];
+};
+
+status_t AudioPolicySimulator::loadScript(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "cannot open script %s\n", path);
+        return NAME_NOT_FOUND;
+    }
+    char line[256];
+    int lineNumber = 0;
+    status_t status = NO_ERROR;
+    while (status == NO_ERROR && fgets(line, sizeof(line), f) != NULL) {
+        lineNumber++;
+        status = parseLine(line, lineNumber);
+    }
+    fclose(f);
+    return status;
+}
+
+status_t AudioPolicySimulator::loadTrace(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open trace %s\n", path);
+        return NAME_NOT_FOUND;
+    }
+    status_t status = AudioPolicyTrace::readRecords(fd, mRecords);
+    close(fd);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "invalid trace %s\n", path);
+        return status;
+    }
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        const audio_policy_trace_record& record = mRecords[i];
+        if (record.event < AudioPolicyTrace::NUM_EVENTS) {
+            mRecordedStats[record.event].mLatencies.add(record.duration);
+        }
+    }
+    return NO_ERROR;
+}
+
+status_t AudioPolicySimulator::parseLine(char *line, int lineNumber)
+{
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+    char *saveptr;
+    char *keyword = strtok_r(line, " \t\r\n", &saveptr);
+    if (keyword == NULL) {
+        return NO_ERROR;
+    }
+    char *args[4];
+    int numArgs = 0;
+    char *arg;
+    while ((arg = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+        if (numArgs == 4) {
+            fprintf(stderr, "line %d: too many arguments\n", lineNumber);
+            return BAD_VALUE;
+        }
+        args[numArgs++] = arg;
+    }
+
+    SimEvent event;
+    memset(&event, 0, sizeof(event));
+    event.mLine = lineNumber;
+    int type;
+    for (type = 0; type < SIM_NUM_EVENT_TYPES; type++) {
+        if (strcmp(keyword, sEventSyntax[type].keyword) == 0) {
+            break;
+        }
+    }
+    if (type == SIM_NUM_EVENT_TYPES) {
+        fprintf(stderr, "line %d: unknown event %s\n", lineNumber, keyword);
+        return BAD_VALUE;
+    }
+    if (numArgs < sEventSyntax[type].minArgs || numArgs > sEventSyntax[type].maxArgs) {
+        fprintf(stderr, "line %d: %s expects %d to %d arguments\n", lineNumber, keyword,
+                sEventSyntax[type].minArgs, sEventSyntax[type].maxArgs);
+        return BAD_VALUE;
+    }
+    event.mType = (sim_event_type)type;
+
+    switch (event.mType) {
+    case SIM_CONNECT:
+    case SIM_DISCONNECT:
+    case SIM_RECONNECT:
+        event.mArgs[0] = SimAudioPolicyManager::parseDevices(args[0]);
+        if (numArgs > 1) {
+            strncpy(event.mAddress, args[1], MAX_DEVICE_ADDRESS_LEN - 1);
+        }
+        break;
+    case SIM_SET_VOLUME:
+        event.mArgs[0] = atoi(args[0]);
+        event.mArgs[1] = atoi(args[1]);
+        event.mArgs[2] = (numArgs > 2) ? SimAudioPolicyManager::parseDevices(args[2])
+                                       : AUDIO_DEVICE_OUT_DEFAULT;
+        break;
+    default:
+        for (int i = 0; i < numArgs; i++) {
+            event.mArgs[i] = (int)strtol(args[i], NULL, 0);
+        }
+        break;
+    }
+    if ((event.mType >= SIM_GET_OUTPUT && event.mType <= SIM_SET_VOLUME) &&
+            (event.mArgs[0] < 0 || event.mArgs[0] >= AudioSystem::NUM_STREAM_TYPES)) {
+        fprintf(stderr, "line %d: invalid stream %d\n", lineNumber, event.mArgs[0]);
+        return BAD_VALUE;
+    }
+
+    mEvents.add(event);
+    return NO_ERROR;
+}
+
+status_t AudioPolicySimulator::dispatch(const SimEvent& event)
+{
+    AudioSystem::stream_type stream = (AudioSystem::stream_type)event.mArgs[0];
+
+    switch (event.mType) {
+    case SIM_CONNECT:
+    case SIM_DISCONNECT:
+        return mManager.setDeviceConnectionState((audio_devices_t)event.mArgs[0],
+                event.mType == SIM_CONNECT ? AudioSystem::DEVICE_STATE_AVAILABLE :
+                                             AudioSystem::DEVICE_STATE_UNAVAILABLE,
+                event.mAddress);
+    case SIM_PHONE_STATE:
+        mManager.setPhoneState(event.mArgs[0]);
+        return NO_ERROR;
+    case SIM_FORCE_USE:
+        mManager.setForceUse((AudioSystem::force_use)event.mArgs[0],
+                             (AudioSystem::forced_config)event.mArgs[1]);
+        return NO_ERROR;
+    case SIM_GET_OUTPUT:
+        mStreamOutputs[stream] = mManager.getOutput(stream, 44100, AUDIO_FORMAT_PCM_16_BIT,
+                                                    AUDIO_CHANNEL_OUT_STEREO,
+                                                    (AudioSystem::output_flags)event.mArgs[1],
+                                                    NULL);
+        return (mStreamOutputs[stream] != 0) ? NO_ERROR : BAD_VALUE;
+    case SIM_START_OUTPUT:
+        return mManager.startOutput(mStreamOutputs[stream], stream);
+    case SIM_STOP_OUTPUT:
+        return mManager.stopOutput(mStreamOutputs[stream], stream);
+    case SIM_RELEASE_OUTPUT:
+        mManager.releaseOutput(mStreamOutputs[stream]);
+        mStreamOutputs[stream] = 0;
+        return NO_ERROR;
+    case SIM_INIT_VOLUME:
+        mManager.initStreamVolume(stream, event.mArgs[1], event.mArgs[2]);
+        return NO_ERROR;
+    case SIM_SET_VOLUME:
+        return mManager.setStreamVolumeIndex(stream, event.mArgs[1],
+                                             (audio_devices_t)event.mArgs[2]);
+    case SIM_BEGIN_CONNECTIONS:
+        mManager.beginDeviceConnectionChanges();
+        return NO_ERROR;
+    case SIM_COMMIT_CONNECTIONS:
+        return mManager.commitDeviceConnectionChanges();
+    case SIM_RECONNECT: {
+        // e.g. an A2DP sink replaced by another one, reported in a single transaction
+        const AudioPolicyManagerBase::DeviceConnectionChange changes[] = {
+            { (audio_devices_t)event.mArgs[0], AudioSystem::DEVICE_STATE_UNAVAILABLE, "" },
+            { (audio_devices_t)event.mArgs[0], AudioSystem::DEVICE_STATE_AVAILABLE,
+              event.mAddress },
+        };
+        return mManager.setDeviceConnectionStates(changes, 2);
+    }
+    default:
+        return BAD_VALUE;
+    }
+}
+
+void AudioPolicySimulator::run(int iterations)
+{
+    mClient.resetCallCounts();
+    for (int n = 0; n < iterations; n++) {
+        for (size_t i = 0; i < mEvents.size(); i++) {
+            const SimEvent& event = mEvents[i];
+            SimEventStats& stats = mStats[event.mType];
+
+            uint64_t allocCount = sAllocCount;
+            uint64_t allocBytes = sAllocBytes;
+            nsecs_t start = systemTime();
+            status_t status = dispatch(event);
+            nsecs_t latency = systemTime() - start;
+
+            stats.mAllocCount += sAllocCount - allocCount;
+            stats.mAllocBytes += sAllocBytes - allocBytes;
+            stats.mLatencies.add(latency);
+            if (status != NO_ERROR) {
+                stats.mErrors++;
+            }
+            if (mVerbose) {
+                printf("line %3d %-18s status %d %8lld us\n", event.mLine,
+                       sEventSyntax[event.mType].keyword, status, (long long)ns2us(latency));
+            }
+        }
+    }
+}
+
+// Issues the recorded call. Returns false if the result differs from the recorded one.
+bool AudioPolicySimulator::replayRecord(const audio_policy_trace_record& record)
+{
+    const int32_t *args = record.args;
+    AudioSystem::stream_type stream = (AudioSystem::stream_type)args[1];
+    audio_io_handle_t handle;
+    status_t status;
+
+    switch (record.event) {
+    case AudioPolicyTrace::SET_DEVICE_CONNECTION_STATE:
+        status = mManager.setDeviceConnectionState((audio_devices_t)args[0],
+                                                   (AudioSystem::device_connection_state)args[1],
+                                                   record.address);
+        return status == record.result;
+    case AudioPolicyTrace::SET_PHONE_STATE:
+        mManager.setPhoneState(args[0]);
+        return true;
+    case AudioPolicyTrace::SET_FORCE_USE:
+        mManager.setForceUse((AudioSystem::force_use)args[0],
+                             (AudioSystem::forced_config)args[1]);
+        return true;
+    case AudioPolicyTrace::GET_OUTPUT:
+        handle = mManager.getOutput((AudioSystem::stream_type)args[0], args[1],
+                                    (audio_format_t)args[2], (audio_channel_mask_t)args[3],
+                                    (AudioSystem::output_flags)args[4], NULL);
+        if (handle != 0 && record.result != 0) {
+            mOutputMap.add(record.result, handle);
+        }
+        return (handle != 0) == (record.result != 0);
+    case AudioPolicyTrace::START_OUTPUT:
+        status = mManager.startOutput(mOutputMap.valueFor(args[0]), stream, args[2]);
+        return status == record.result;
+    case AudioPolicyTrace::STOP_OUTPUT:
+        status = mManager.stopOutput(mOutputMap.valueFor(args[0]), stream, args[2]);
+        return status == record.result;
+    case AudioPolicyTrace::RELEASE_OUTPUT:
+        mManager.releaseOutput(mOutputMap.valueFor(args[0]));
+        return true;
+    case AudioPolicyTrace::GET_INPUT:
+        handle = mManager.getInput(args[0], args[1], (audio_format_t)args[2],
+                                   (audio_channel_mask_t)args[3],
+                                   (AudioSystem::audio_in_acoustics)args[4]);
+        if (handle != 0 && record.result != 0) {
+            mInputMap.add(record.result, handle);
+        }
+        return (handle != 0) == (record.result != 0);
+    case AudioPolicyTrace::START_INPUT:
+        status = mManager.startInput(mInputMap.valueFor(args[0]));
+        return status == record.result;
+    case AudioPolicyTrace::STOP_INPUT:
+        status = mManager.stopInput(mInputMap.valueFor(args[0]));
+        return status == record.result;
+    case AudioPolicyTrace::RELEASE_INPUT:
+        mManager.releaseInput(mInputMap.valueFor(args[0]));
+        return true;
+    case AudioPolicyTrace::INIT_STREAM_VOLUME:
+        mManager.initStreamVolume((AudioSystem::stream_type)args[0], args[1], args[2]);
+        return true;
+    case AudioPolicyTrace::SET_STREAM_VOLUME_INDEX:
+        status = mManager.setStreamVolumeIndex((AudioSystem::stream_type)args[0], args[1],
+                                               (audio_devices_t)args[2]);
+        return status == record.result;
+    case AudioPolicyTrace::SET_CAN_MUTE_ENFORCED_AUDIBLE:
+        mManager.setSystemProperty("ro.camera.sound.forced", args[0] ? "0" : "1");
+        return true;
+    default:
+        return false;
+    }
+}
+
+void AudioPolicySimulator::replay(int iterations, bool realTime)
+{
+    mClient.resetCallCounts();
+    for (int n = 0; n < iterations; n++) {
+        nsecs_t replayStart = systemTime();
+        for (size_t i = 0; i < mRecords.size(); i++) {
+            const audio_policy_trace_record& record = mRecords[i];
+            if (record.event >= AudioPolicyTrace::NUM_EVENTS) {
+                continue;
+            }
+            SimEventStats& stats = mTraceStats[record.event];
+
+            if (realTime) {
+                nsecs_t delay = replayStart + (record.timestamp - mRecords[0].timestamp) -
+                        systemTime();
+                if (delay > 0) {
+                    struct timespec ts;
+                    ts.tv_sec = delay / 1000000000;
+                    ts.tv_nsec = delay % 1000000000;
+                    nanosleep(&ts, NULL);
+                }
+            }
+
+            uint64_t allocCount = sAllocCount;
+            uint64_t allocBytes = sAllocBytes;
+            nsecs_t start = systemTime();
+            bool match = replayRecord(record);
+            nsecs_t latency = systemTime() - start;
+
+            stats.mAllocCount += sAllocCount - allocCount;
+            stats.mAllocBytes += sAllocBytes - allocBytes;
+            stats.mLatencies.add(latency);
+            if (!match) {
+                stats.mErrors++;
+            }
+            if (mVerbose || !match) {
+                printf("seq %6d %-26s recorded %d %8lld us replayed %8lld us%s\n",
+                       record.seq - 1, AudioPolicyTrace::eventName(record.event), record.result,
+                       (long long)ns2us(record.duration), (long long)ns2us(latency),
+                       match ? "" : " MISMATCH");
+            }
+        }
+    }
+}
+
+static int compareNsecs(const void *a, const void *b)
+{
+    nsecs_t d = *(const nsecs_t *)a - *(const nsecs_t *)b;
+    return (d < 0) ? -1 : ((d > 0) ? 1 : 0);
+}
+
+static long long percentileUs(const Vector<nsecs_t>& sorted, int percent)
+{
+    return (long long)ns2us(sorted[(sorted.size() - 1) * percent / 100]);
+}
+
+static void reportHeader(const char *title)
+{
+    printf("\n%-26s %7s %6s %9s %9s %9s %9s %11s %11s\n", title, "count", "errors",
+           "p50 us", "p90 us", "p99 us", "max us", "allocs/evt", "bytes/evt");
+}
+
+static void reportStats(const char *name, SimEventStats& stats)
+{
+    size_t count = stats.mLatencies.size();
+    if (count == 0) {
+        return;
+    }
+    qsort(stats.mLatencies.editArray(), count, sizeof(nsecs_t), compareNsecs);
+    printf("%-26s %7zu %6u %9lld %9lld %9lld %9lld %11.1f %11.1f\n",
+           name, count, stats.mErrors,
+           percentileUs(stats.mLatencies, 50),
+           percentileUs(stats.mLatencies, 90),
+           percentileUs(stats.mLatencies, 99),
+           percentileUs(stats.mLatencies, 100),
+           (double)stats.mAllocCount / count,
+           (double)stats.mAllocBytes / count);
+}
+
+void AudioPolicySimulator::report()
+{
+    if (mEvents.size() != 0) {
+        reportHeader("event");
+        for (int i = 0; i < SIM_NUM_EVENT_TYPES; i++) {
+            reportStats(sEventSyntax[i].keyword, mStats[i]);
+        }
+    }
+    if (mRecords.size() != 0) {
+        reportHeader("recorded call");
+        for (int i = 0; i < AudioPolicyTrace::NUM_EVENTS; i++) {
+            reportStats(AudioPolicyTrace::eventName(i), mRecordedStats[i]);
+        }
+        reportHeader("replayed call");
+        for (int i = 0; i < AudioPolicyTrace::NUM_EVENTS; i++) {
+            reportStats(AudioPolicyTrace::eventName(i), mTraceStats[i]);
+        }
+    }
+
+    printf("\n%-20s %9s\n", "client call", "count");
+    for (int i = 0; i < FakeAudioPolicyClient::NUM_CALL_TYPES; i++) {
+        FakeAudioPolicyClient::call_type type = (FakeAudioPolicyClient::call_type)i;
+        if (mClient.callCount(type) != 0) {
+            printf("%-20s %9u\n", FakeAudioPolicyClient::callName(type), mClient.callCount(type));
+        }
+    }
+
+    // the manager is called directly, bypassing the HAL: only the time it spent sleeping
+    // for outputs to drain shows up in the latency histograms
+    fflush(stdout);
+    AudioPolicyLatency::dump(STDOUT_FILENO);
+}
+
+}; // namespace android_audio_legacy
+
+using namespace android_audio_legacy;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c audio_policy.conf] [-n iterations] [-v] script\n"
+                    "       %s [-c audio_policy.conf] [-n iterations] [-v] [-r] -t trace\n",
+            name, name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *configFile = NULL;
+    int iterations = 1;
+    bool verbose = false;
+    bool trace = false;
+    bool realTime = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:rtv")) != -1) {
+        switch (opt) {
+        case 'c':
+            configFile = optarg;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'r':
+            realTime = true;
+            break;
+        case 't':
+            trace = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    AudioPolicySimulator *sim = new AudioPolicySimulator(configFile, verbose);
+    if (trace) {
+        if (sim->loadTrace(argv[optind]) != NO_ERROR) {
+            delete sim;
+            return 1;
+        }
+        sim->replay(iterations, realTime);
+    } else {
+        if (sim->loadScript(argv[optind]) != NO_ERROR) {
+            delete sim;
+            return 1;
+        }
+        sim->run(iterations);
+    }
+    sim->report();
+    delete sim;
+    return 0;
+}
@@ -0,0 +1,60 @@
+# Copyright 2014 The Android Open Source Project
+
+# Reference GSCAN engine: bucket scheduling against a simulated scan backend, and
+# gscan_sim, which runs it on a scan configuration and reports radio usage and cost.
+# Built for the device and, on Linux hosts, for the build machine.
+
+LOCAL_PATH := $(call my-dir)
+
+gscan_ref_src_files := \
+    GScanCache.cpp \
+    GScanHotlist.cpp \
+    GScanScheduler.cpp \
+    GScanSimulator.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(gscan_ref_src_files)
+LOCAL_MODULE := libgscan_ref
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wno-unused-parameter
+
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := gscan_sim.cpp
+LOCAL_STATIC_LIBRARIES := libgscan_ref
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    liblog
+LOCAL_MODULE := gscan_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wno-unused-parameter
+
+include $(BUILD_EXECUTABLE)
+
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(gscan_ref_src_files)
+LOCAL_MODULE := libgscan_ref
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wno-unused-parameter
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := gscan_sim.cpp
+LOCAL_STATIC_LIBRARIES := \
+    libgscan_ref \
+    libcutils \
+    liblog
+LOCAL_LDLIBS := -lpthread -lrt
+LOCAL_MODULE := gscan_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Wno-unused-parameter
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GScanCache"
+//#define LOG_NDEBUG 0
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "GScanCache.h"
+
+namespace android_wifi_legacy {
+
+#define RESULT_HEADER_SIZE offsetof(wifi_scan_result, ie_data)
+
+GScanCache::Iterator::Iterator(const GScanCache *cache)
+    : mCache(cache), mScan(0), mResult(0)
+{
+}
+
+const wifi_scan_result *GScanCache::Iterator::next()
+{
+    // the scan in progress is not part of the history yet
+    int numScans = mCache->mNumScans - (mCache->mScanning ? 1 : 0);
+
+    while (mScan < numScans) {
+        const Scan *scan = mCache->scanAt(mScan);
+        if (mResult < scan->numResults) {
+            return scan->entries[mResult++].result;
+        }
+        mScan++;
+        mResult = 0;
+    }
+    return NULL;
+}
+
+GScanCache::GScanCache()
+    : mMaxScans(0), mMaxApPerScan(0), mReportThreshold(0), mScans(NULL), mEntries(NULL),
+      mFirstScan(0), mNumScans(0), mNumResults(0), mScanning(false), mReported(false),
+      mDroppedUnreported(false),
+      mArena(NULL), mNumSlabs(0), mSlabs(NULL), mEmptySlabs(NULL), mUsedSize(0),
+      mPeakUsedSize(0)
+{
+    memset(mPartialSlabs, 0, sizeof(mPartialSlabs));
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+GScanCache::~GScanCache()
+{
+    release();
+}
+
+void GScanCache::release()
+{
+    free(mArena);
+    delete[] mSlabs;
+    delete[] mEntries;
+    delete[] mScans;
+    mArena = NULL;
+    mSlabs = NULL;
+    mEntries = NULL;
+    mScans = NULL;
+    mNumSlabs = 0;
+    mMaxScans = 0;
+}
+
+wifi_error GScanCache::init(const wifi_scan_cmd_params& params, int maxScans, size_t cacheSize)
+{
+    release();
+
+    if (maxScans <= 0 || params.max_ap_per_scan <= 0 ||
+            params.report_threshold < 0 || params.report_threshold > 100 ||
+            cacheSize < SLAB_SIZE) {
+        ALOGE("invalid cache of %d scans of %d APs, threshold %d%%, %zu bytes",
+              maxScans, params.max_ap_per_scan, params.report_threshold, cacheSize);
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    mNumSlabs = cacheSize / SLAB_SIZE;
+    mArena = (char *)malloc(mNumSlabs * SLAB_SIZE);
+    mSlabs = new Slab[mNumSlabs];
+    mScans = new Scan[maxScans];
+    mEntries = new Entry[maxScans * params.max_ap_per_scan];
+    if (mArena == NULL) {
+        release();
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+    mMaxScans = maxScans;
+    mMaxApPerScan = params.max_ap_per_scan;
+    mReportThreshold = params.report_threshold;
+    for (int i = 0; i < mMaxScans; i++) {
+        mScans[i].entries = &mEntries[i * mMaxApPerScan];
+    }
+
+    mScanning = false;
+    mPeakUsedSize = 0;
+    memset(&mStats, 0, sizeof(mStats));
+    resetArena();
+    return WIFI_SUCCESS;
+}
+
+void GScanCache::resetArena()
+{
+    mFirstScan = 0;
+    mNumScans = 0;
+    mNumResults = 0;
+    mReported = false;
+    mDroppedUnreported = false;
+    mUsedSize = 0;
+    mEmptySlabs = NULL;
+    memset(mPartialSlabs, 0, sizeof(mPartialSlabs));
+    for (size_t i = mNumSlabs; i > 0; i--) {
+        linkSlab(&mEmptySlabs, &mSlabs[i - 1]);
+    }
+}
+
+void GScanCache::unlinkSlab(Slab **list, Slab *slab)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+void GScanCache::linkSlab(Slab **list, Slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+int GScanCache::sizeClass(size_t size)
+{
+    int c = 0;
+    while ((MIN_RECORD_SIZE << c) < size) {
+        c++;
+    }
+    return c;
+}
+
+void *GScanCache::allocRecord(int sizeClass)
+{
+    size_t size = MIN_RECORD_SIZE << sizeClass;
+    Slab *slab = mPartialSlabs[sizeClass];
+
+    if (slab == NULL) {
+        slab = mEmptySlabs;
+        if (slab == NULL) {
+            return NULL;
+        }
+        unlinkSlab(&mEmptySlabs, slab);
+        slab->freeRecords = NULL;
+        slab->carved = 0;
+        slab->used = 0;
+        slab->sizeClass = sizeClass;
+        linkSlab(&mPartialSlabs[sizeClass], slab);
+    }
+
+    void *record;
+    if (slab->freeRecords != NULL) {
+        record = slab->freeRecords;
+        slab->freeRecords = slab->freeRecords->next;
+    } else {
+        // records are carved on first use
+        record = mArena + (slab - mSlabs) * SLAB_SIZE + slab->carved;
+        slab->carved += size;
+    }
+    slab->used++;
+    if (slab->freeRecords == NULL && slab->carved + size > SLAB_SIZE) {
+        unlinkSlab(&mPartialSlabs[sizeClass], slab);
+    }
+
+    mUsedSize += size;
+    if (mUsedSize > mPeakUsedSize) {
+        mPeakUsedSize = mUsedSize;
+    }
+    return record;
+}
+
+void GScanCache::freeRecord(wifi_scan_result *result)
+{
+    Slab *slab = &mSlabs[((char *)result - mArena) / SLAB_SIZE];
+    size_t size = MIN_RECORD_SIZE << slab->sizeClass;
+    bool full = slab->freeRecords == NULL && slab->carved + size > SLAB_SIZE;
+
+    FreeRecord *record = (FreeRecord *)result;
+    record->next = slab->freeRecords;
+    slab->freeRecords = record;
+    slab->used--;
+    mUsedSize -= size;
+
+    if (slab->used == 0) {
+        if (!full) {
+            unlinkSlab(&mPartialSlabs[slab->sizeClass], slab);
+        }
+        linkSlab(&mEmptySlabs, slab);
+    } else if (full) {
+        linkSlab(&mPartialSlabs[slab->sizeClass], slab);
+    }
+}
+
+wifi_scan_result *GScanCache::storeResult(const wifi_scan_result& result)
+{
+    size_t ieLength = result.ie_length;
+
+    if (RESULT_HEADER_SIZE + ieLength > MAX_RECORD_SIZE) {
+        // keep the elements that fit whole
+        const byte *ie = (const byte *)result.ie_data;
+        size_t room = MAX_RECORD_SIZE - RESULT_HEADER_SIZE;
+        ieLength = 0;
+        while (ieLength + 2 <= room && ieLength + 2 + ie[ieLength + 1] <= room) {
+            ieLength += 2 + ie[ieLength + 1];
+        }
+        mStats.truncated++;
+    }
+
+    int c = sizeClass(RESULT_HEADER_SIZE + ieLength);
+    wifi_scan_result *stored;
+    while ((stored = (wifi_scan_result *)allocRecord(c)) == NULL) {
+        // make room by dropping the oldest scan, but not the current one
+        if (mNumScans <= 1) {
+            return NULL;
+        }
+        dropOldestScan();
+    }
+    memcpy(stored, &result, RESULT_HEADER_SIZE + ieLength);
+    stored->ie_length = ieLength;
+    return stored;
+}
+
+void GScanCache::dropScan(Scan *scan)
+{
+    for (int i = 0; i < scan->numResults; i++) {
+        freeRecord(scan->entries[i].result);
+    }
+    mNumResults -= scan->numResults;
+    scan->numResults = 0;
+}
+
+// puts e at the root of the heap of n entries and restores the heap order
+void GScanCache::siftDown(Entry *heap, int n, Entry e)
+{
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && heap[child + 1].rssi < heap[child].rssi) {
+            child++;
+        }
+        if (heap[child].rssi >= e.rssi) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = e;
+}
+
+void GScanCache::dropOldestScan()
+{
+    dropScan(scanAt(0));
+    mFirstScan = (mFirstScan + 1) % mMaxScans;
+    mNumScans--;
+    mStats.evictedScans++;
+    if (!mReported) {
+        mStats.bufferFull++;
+        mDroppedUnreported = true;
+    }
+}
+
+void GScanCache::beginScan(wifi_timestamp ts)
+{
+    if (mMaxScans == 0) {
+        return;
+    }
+    if (mScanning) {
+        endScan();
+    }
+    if (mNumScans == mMaxScans) {
+        dropOldestScan();
+    }
+    Scan *scan = scanAt(mNumScans++);
+    scan->ts = ts;
+    scan->numResults = 0;
+    mScanning = true;
+    mStats.scans++;
+}
+
+void GScanCache::addResult(const wifi_scan_result& result)
+{
+    if (!mScanning) {
+        return;
+    }
+    mStats.results++;
+
+    Scan *scan = scanAt(mNumScans - 1);
+    Entry *heap = scan->entries;
+    int n = scan->numResults;
+    int i;
+
+    if (n < mMaxApPerScan) {
+        wifi_scan_result *stored = storeResult(result);
+        if (stored == NULL) {
+            mStats.noMemory++;
+            return;
+        }
+        // sift up
+        for (i = n; i > 0 && heap[(i - 1) / 2].rssi > result.rssi; i = (i - 1) / 2) {
+            heap[i] = heap[(i - 1) / 2];
+        }
+        heap[i].rssi = result.rssi;
+        heap[i].result = stored;
+        scan->numResults++;
+        mNumResults++;
+        return;
+    }
+
+    if (result.rssi <= heap[0].rssi) {
+        mStats.rejected++;
+        return;
+    }
+    // replace the weakest result. Its record is released first so that it can be reused.
+    freeRecord(heap[0].result);
+    wifi_scan_result *stored = storeResult(result);
+    if (stored == NULL) {
+        // the weakest result is gone anyway, the last entry moves to the root
+        scan->numResults = --n;
+        mNumResults--;
+        mStats.noMemory++;
+        heap[0] = heap[n];
+    } else {
+        heap[0].rssi = result.rssi;
+        heap[0].result = stored;
+        mStats.replaced++;
+    }
+    siftDown(heap, n, heap[0]);
+}
+
+bool GScanCache::endScan()
+{
+    if (!mScanning) {
+        return false;
+    }
+    mScanning = false;
+
+    // heap sort in place: popping the weakest to the end leaves the strongest first
+    Scan *scan = scanAt(mNumScans - 1);
+    Entry *heap = scan->entries;
+    for (int n = scan->numResults - 1; n > 0; n--) {
+        Entry last = heap[n];
+        heap[n] = heap[0];
+        siftDown(heap, n, last);
+    }
+
+    // the history is full when its scans, its results or its records reach the threshold.
+    // Scans count too: results fewer than max_ap_per_scan would otherwise never reach it.
+    if (!mReported && (mNumScans * 100 >= mMaxScans * mReportThreshold ||
+            mNumResults * 100 >= capacity() * mReportThreshold ||
+            mUsedSize * 100 >= arenaSize() * mReportThreshold || mDroppedUnreported)) {
+        mReported = true;
+        mStats.wakeups++;
+        ALOGV("%d scans, %d results cached in %zu bytes, reached %d%% of %d scans, %d results "
+              "or %zu bytes%s", mNumScans, mNumResults, mUsedSize, mReportThreshold, mMaxScans,
+              capacity(), arenaSize(), mDroppedUnreported ? ", scans dropped" : "");
+        return true;
+    }
+    return false;
+}
+
+int GScanCache::getCachedResults(int max, wifi_scan_result *results) const
+{
+    Iterator it = this->results();
+    const wifi_scan_result *result;
+    int num = 0;
+
+    while (num < max && (result = it.next()) != NULL) {
+        memcpy(&results[num], result, RESULT_HEADER_SIZE);
+        results[num].ie_length = 0;
+        num++;
+    }
+    return num;
+}
+
+void GScanCache::flush()
+{
+    if (!mScanning) {
+        resetArena();
+        return;
+    }
+    // keep the scan in progress
+    Scan current = *scanAt(mNumScans - 1);
+    for (int i = 0; i < mNumScans - 1; i++) {
+        dropScan(scanAt(i));
+    }
+    Scan *scan = scanAt(0);
+    Entry *entries = scan->entries;
+    memmove(entries, current.entries, current.numResults * sizeof(Entry));
+    *scan = current;
+    scan->entries = entries;
+    mNumScans = 1;
+    mReported = false;
+    mDroppedUnreported = false;
+}
+
+}; // namespace android_wifi_legacy
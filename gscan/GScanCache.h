@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GSCANCACHE_H
+#define ANDROID_GSCANCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware_legacy/gscan.h>
+
+namespace android_wifi_legacy {
+
+// ----------------------------------------------------------------------------
+
+// GScanCache is the reference implementation of the GSCAN scan history: the results of
+// the last scans, at most max_ap_per_scan per scan, as returned by
+// wifi_get_cached_gscan_results().
+//
+// Each scan keeps its results in a fixed capacity min-heap on RSSI, so that once the
+// scan is full a result only costs a comparison with the weakest one it would replace.
+// When the scan ends the heap is sorted in place, strongest first. Results are stored
+// whole, wifi_scan_result followed by its information elements, in records carved from
+// slabs of an arena allocated by init(): storing, replacing and flushing results never
+// calls malloc. A slab goes back to the arena as soon as its last record is freed, so
+// that record sizes can change from scan to scan. The oldest scan is dropped when a new
+// one does not fit, in scans or in memory. A scan dropped before the history was reported
+// is counted as a WIFI_SCAN_BUFFER_FULL event and forces a report at the end of the scan.
+//
+// The cache is not thread safe, the caller serializes the scan and flush paths.
+class GScanCache
+{
+public:
+    static const size_t SLAB_SIZE = 4096;
+    // record sizes, a result with longer information elements keeps the first ones only
+    static const size_t MIN_RECORD_SIZE = 128;
+    static const int NUM_SIZE_CLASSES = 6;
+    static const size_t MAX_RECORD_SIZE = MIN_RECORD_SIZE << (NUM_SIZE_CLASSES - 1);
+
+    // iterates over the results of the completed scans, oldest first, each scan strongest
+    // first. Results point into the cache and are valid until the next call changing it.
+    class Iterator
+    {
+    public:
+        const wifi_scan_result *next();
+        // index of the scan the last result returned belongs to, 0 for the oldest
+        int                     scan() const { return mScan; }
+
+    private:
+        friend class GScanCache;
+                                Iterator(const GScanCache *cache);
+
+        const GScanCache *mCache;
+        int mScan;
+        int mResult;
+    };
+
+    struct Stats {
+        uint64_t scans;
+        uint64_t results;               // results offered to addResult()
+        uint64_t replaced;              // stored results replaced by a stronger one
+        uint64_t rejected;              // results weaker than a full scan
+        uint64_t truncated;             // results stored without some of their elements
+        uint64_t noMemory;              // results dropped, the current scan filling the arena
+        uint64_t evictedScans;          // scans dropped to make room for newer results
+        uint64_t bufferFull;            // of which dropped before a report, WIFI_SCAN_BUFFER_FULL
+        uint64_t wakeups;               // times endScan() reached report_threshold
+    };
+
+                        GScanCache();
+                        ~GScanCache();
+
+    // sizes the cache for maxScans scans of params.max_ap_per_scan results, in an arena of
+    // cacheSize bytes (wifi_gscan_capabilities.max_scan_cache_size). Drops any cached result.
+    wifi_error          init(const wifi_scan_cmd_params& params, int maxScans, size_t cacheSize);
+
+    // starts a new scan, dropping the oldest one if all scans are in use
+    void                beginScan(wifi_timestamp ts);
+    // stores result, with its ie_data, if it is among the strongest of the current scan
+    void                addResult(const wifi_scan_result& result);
+    // ends the current scan. Returns true when the cache just reached report_threshold, in
+    // scans, results or arena bytes, or dropped a scan not reported yet, once until the next
+    // flush: the caller then reports on_scan_results_available.
+    bool                endScan();
+
+    int                 numScans() const { return mNumScans; }
+    // results stored, including those of the scan in progress
+    int                 numResults() const { return mNumResults; }
+    // maxScans * max_ap_per_scan
+    int                 capacity() const { return mMaxScans * mMaxApPerScan; }
+    Iterator            results() const { return Iterator(this); }
+    // copies up to max results, oldest first, in the wifi_get_cached_gscan_results()
+    // layout. Information elements are not copied, ie_length is 0: they are available
+    // from results() only.
+    int                 getCachedResults(int max, wifi_scan_result *results) const;
+    // drops the results of the completed scans
+    void                flush();
+
+    size_t              arenaSize() const { return mNumSlabs * SLAB_SIZE; }
+    // bytes of the arena in use by records, and the peak since init()
+    size_t              usedSize() const { return mUsedSize; }
+    size_t              peakUsedSize() const { return mPeakUsedSize; }
+    const Stats&        stats() const { return mStats; }
+
+private:
+    // a heap slot. The RSSI is duplicated to keep sift operations in the heap array.
+    struct Entry {
+        wifi_rssi rssi;
+        wifi_scan_result *result;
+    };
+
+    struct Scan {
+        wifi_timestamp ts;
+        int numResults;
+        Entry *entries;                 // mMaxApPerScan slots, a min-heap until endScan()
+    };
+
+    // a free record, linked through its first bytes
+    struct FreeRecord {
+        FreeRecord *next;
+    };
+
+    struct Slab {
+        FreeRecord *freeRecords;
+        size_t carved;                  // bytes of the slab carved into records so far
+        int used;                       // records in use
+        int sizeClass;
+        // in the list of the slabs of sizeClass with free records, or of the empty slabs
+        Slab *prev;
+        Slab *next;
+    };
+
+    void                release();
+    void                resetArena();
+    static int          sizeClass(size_t size);
+    static void         unlinkSlab(Slab **list, Slab *slab);
+    static void         linkSlab(Slab **list, Slab *slab);
+    void               *allocRecord(int sizeClass);
+    void                freeRecord(wifi_scan_result *result);
+    wifi_scan_result   *storeResult(const wifi_scan_result& result);
+    void                dropScan(Scan *scan);
+    void                dropOldestScan();
+    static void         siftDown(Entry *heap, int n, Entry e);
+    Scan               *scanAt(int i) const {
+                            return &mScans[(mFirstScan + i) % mMaxScans];
+                        }
+
+    int mMaxScans;
+    int mMaxApPerScan;
+    int mReportThreshold;
+
+    // ring of scans, the current one is the last
+    Scan *mScans;
+    Entry *mEntries;
+    int mFirstScan;
+    int mNumScans;
+    int mNumResults;
+    bool mScanning;
+    bool mReported;
+    // a scan was dropped while mReported was not set
+    bool mDroppedUnreported;
+
+    // arena of mNumSlabs slabs, given to a size class on demand
+    char *mArena;
+    size_t mNumSlabs;
+    Slab *mSlabs;
+    Slab *mEmptySlabs;
+    Slab *mPartialSlabs[NUM_SIZE_CLASSES];
+    size_t mUsedSize;
+    size_t mPeakUsedSize;
+
+    Stats mStats;
+};
+
+}; // namespace android_wifi_legacy
+
+#endif // ANDROID_GSCANCACHE_H
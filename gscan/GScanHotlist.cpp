@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GScanHotlist"
+//#define LOG_NDEBUG 0
+
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "GScanHotlist.h"
+
+namespace android_wifi_legacy {
+
+GScanHotlist::GScanHotlist()
+{
+    memset(&mHandler, 0, sizeof(mHandler));
+    reset();
+}
+
+void GScanHotlist::reset()
+{
+    mId = 0;
+    mLostApSampleSize = 1;
+    mNumAps = 0;
+    memset(mTable, 0, sizeof(mTable));
+    mScan = 0;
+    mTick = NULL;
+    mNumFound = 0;
+    mNumLost = 0;
+}
+
+uint32_t GScanHotlist::hash(const mac_addr bssid)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++) {
+        key = (key << 8) | bssid[i];
+    }
+    // multiplicative hashing: the top bits depend on all the bytes, vendor OUIs included
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> (64 - HASH_BITS));
+}
+
+int GScanHotlist::find(const mac_addr bssid) const
+{
+    for (uint32_t slot = hash(bssid); mTable[slot] != 0; slot = (slot + 1) & (HASH_SIZE - 1)) {
+        const Ap& ap = mAps[mTable[slot] - 1];
+        if (memcmp(ap.bssid, bssid, sizeof(mac_addr)) == 0) {
+            return mTable[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+wifi_error GScanHotlist::init(wifi_request_id id, const wifi_bssid_hotlist_params& params,
+                              wifi_hotlist_ap_found_handler handler)
+{
+    reset();
+
+    if (params.num_ap < 0 || params.num_ap > (int)MAX_HOTLIST_APS ||
+            params.lost_ap_sample_size <= 0) {
+        ALOGE("invalid hotlist of %d APs, lost sample size %d",
+              params.num_ap, params.lost_ap_sample_size);
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    for (int i = 0; i < params.num_ap; i++) {
+        const ap_threshold_param& param = params.ap[i];
+        if (param.low > param.high) {
+            ALOGE("AP %d: low threshold %d above high threshold %d", i, param.low, param.high);
+            reset();
+            return WIFI_ERROR_INVALID_ARGS;
+        }
+
+        uint32_t slot = hash(param.bssid);
+        for (; mTable[slot] != 0; slot = (slot + 1) & (HASH_SIZE - 1)) {
+            if (memcmp(mAps[mTable[slot] - 1].bssid, param.bssid, sizeof(mac_addr)) == 0) {
+                ALOGE("AP %d: BSSID listed twice", i);
+                reset();
+                return WIFI_ERROR_INVALID_ARGS;
+            }
+        }
+        mTable[slot] = mNumAps + 1;
+
+        Ap *ap = &mAps[mNumAps++];
+        memcpy(ap->bssid, param.bssid, sizeof(mac_addr));
+        ap->low = param.low;
+        ap->high = param.high;
+        ap->channel = param.channel;
+        ap->found = false;
+        ap->missed = 0;
+        ap->seenScan = 0;
+        memset(&ap->last, 0, sizeof(ap->last));
+    }
+
+    mId = id;
+    mHandler = handler;
+    mLostApSampleSize = params.lost_ap_sample_size;
+    return WIFI_SUCCESS;
+}
+
+void GScanHotlist::beginScan(const GScanScheduler::Tick *tick)
+{
+    // scan numbers start at 1, seenScan 0 is never seen
+    mScan++;
+    mTick = tick;
+}
+
+void GScanHotlist::onScanResult(const wifi_scan_result& result)
+{
+    int index = find(result.bssid);
+    if (index < 0) {
+        return;
+    }
+    Ap *ap = &mAps[index];
+    if (ap->seenScan != mScan || result.rssi > ap->last.rssi) {
+        ap->seenScan = mScan;
+        memcpy(&ap->last, &result, sizeof(ap->last));
+        ap->last.ie_length = 0;
+    }
+}
+
+bool GScanHotlist::channelScanned(wifi_channel channel) const
+{
+    if (mTick == NULL || channel == 0) {
+        return true;
+    }
+    // tick channels are in frequency order
+    int lo = 0, hi = mTick->numChannels;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mTick->channels[mid].channel < channel) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < mTick->numChannels && mTick->channels[lo].channel == channel;
+}
+
+void GScanHotlist::endScan()
+{
+    unsigned numFound = 0;
+    unsigned numLost = 0;
+
+    for (int i = 0; i < mNumAps; i++) {
+        Ap *ap = &mAps[i];
+        bool seen = ap->seenScan == mScan;
+
+        if (seen && ap->last.rssi >= ap->high) {
+            ap->missed = 0;
+            if (!ap->found) {
+                ap->found = true;
+                mFound[numFound++] = ap->last;
+            }
+        } else if (ap->found) {
+            if (!seen && !channelScanned(ap->channel ? ap->channel : ap->last.channel)) {
+                // not a sample: the channel of the AP was not scanned
+                continue;
+            }
+            if (!seen || ap->last.rssi < ap->low) {
+                if (++ap->missed >= mLostApSampleSize) {
+                    ap->found = false;
+                    ap->missed = 0;
+                    mLost[numLost++] = ap->last;
+                }
+            } else {
+                ap->missed = 0;
+            }
+        }
+    }
+    mTick = NULL;
+
+    if (numFound > 0) {
+        mNumFound += numFound;
+        if (mHandler.on_hotlist_ap_found != NULL) {
+            mHandler.on_hotlist_ap_found(mId, numFound, mFound);
+        }
+    }
+    if (numLost > 0) {
+        mNumLost += numLost;
+        if (mHandler.on_hotlist_ap_lost != NULL) {
+            mHandler.on_hotlist_ap_lost(mId, numLost, mLost);
+        }
+    }
+}
+
+}; // namespace android_wifi_legacy
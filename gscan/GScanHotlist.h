@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GSCANHOTLIST_H
+#define ANDROID_GSCANHOTLIST_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware_legacy/gscan.h>
+
+#include "GScanScheduler.h"
+
+namespace android_wifi_legacy {
+
+// ----------------------------------------------------------------------------
+
+// GScanHotlist is the reference implementation of the BSSID hotlist of
+// wifi_set_bssid_hotlist(): it matches scan results against the hotlist APs and reports
+// the APs found and lost, in one batch of each per scan.
+//
+// Hotlist BSSIDs are indexed in an open addressing hash table on the 6 byte MAC, at most
+// half full, so that a result not in the hotlist, the common case, costs a hash and about
+// one probe. A scan is processed in a single pass over its results: a match only records
+// the strongest RSSI seen for the AP, and endScan() then updates the state of each AP:
+// - an AP is found when it is seen at or above its high threshold,
+// - a found AP is lost after lost_ap_sample_size consecutive scans of its channel in
+//   which it is missed or below its low threshold.
+// Between the thresholds the state does not change, which keeps an AP at the edge of
+// the range from being reported found and lost on every scan.
+//
+// The matcher does not allocate once init() is done and is not thread safe.
+class GScanHotlist
+{
+public:
+    // power of two, at least twice MAX_HOTLIST_APS
+    static const uint32_t HASH_BITS = 8;
+    static const uint32_t HASH_SIZE = 1 << HASH_BITS;
+
+                        GScanHotlist();
+
+    // validates and indexes params. Returns WIFI_ERROR_INVALID_ARGS if they are not valid,
+    // e.g. a BSSID listed twice or a low threshold above the high one.
+    wifi_error          init(wifi_request_id id, const wifi_bssid_hotlist_params& params,
+                             wifi_hotlist_ap_found_handler handler);
+    // forgets the hotlist, as wifi_reset_bssid_hotlist()
+    void                reset();
+
+    int                 numAps() const { return mNumAps; }
+    // returns the hotlist index of bssid, -1 if it is not in the hotlist
+    int                 find(const mac_addr bssid) const;
+
+    // starts a scan of the channels of tick, all channels if tick is NULL. A found AP
+    // missed by a scan not covering its channel is not counted as lost. tick must remain
+    // valid until endScan().
+    void                beginScan(const GScanScheduler::Tick *tick);
+    void                onScanResult(const wifi_scan_result& result);
+    // updates the AP states and calls the handler with the APs found, then those lost.
+    // The arrays passed are valid during the calls only.
+    void                endScan();
+
+    // total number of APs reported found and lost
+    uint64_t            numFound() const { return mNumFound; }
+    uint64_t            numLost() const { return mNumLost; }
+
+private:
+    struct Ap {
+        mac_addr bssid;
+        wifi_rssi low;
+        wifi_rssi high;
+        wifi_channel channel;
+        bool found;
+        int missed;                     // consecutive scans missed or below low
+        uint32_t seenScan;              // mScan when last seen
+        wifi_scan_result last;          // strongest result of the last scan seen, no IE
+    };
+
+    static uint32_t     hash(const mac_addr bssid);
+    bool                channelScanned(wifi_channel channel) const;
+
+    wifi_request_id mId;
+    wifi_hotlist_ap_found_handler mHandler;
+    int mLostApSampleSize;
+
+    int mNumAps;
+    Ap mAps[MAX_HOTLIST_APS];
+    // hotlist index + 1 of each slot, 0 for an empty slot
+    uint8_t mTable[HASH_SIZE];
+
+    uint32_t mScan;
+    const GScanScheduler::Tick *mTick;
+
+    uint64_t mNumFound;
+    uint64_t mNumLost;
+    wifi_scan_result mFound[MAX_HOTLIST_APS];
+    wifi_scan_result mLost[MAX_HOTLIST_APS];
+};
+
+}; // namespace android_wifi_legacy
+
+#endif // ANDROID_GSCANHOTLIST_H
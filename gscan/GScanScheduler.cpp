@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GScanScheduler"
+//#define LOG_NDEBUG 0
+
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "GScanScheduler.h"
+
+namespace android_wifi_legacy {
+
+static const wifi_channel sBgChannels[] = {
+    2412, 2417, 2422, 2427, 2432, 2437, 2442, 2447, 2452, 2457, 2462,
+};
+
+static const wifi_channel sAChannels[] = {
+    5180, 5200, 5220, 5240, 5745, 5765, 5785, 5805, 5825,
+};
+
+static const wifi_channel sADfsChannels[] = {
+    5260, 5280, 5300, 5320, 5500, 5520, 5540, 5560, 5580, 5600, 5620, 5640, 5660, 5680, 5700,
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static bool isDfsChannel(wifi_channel channel)
+{
+    return (channel >= 5260 && channel <= 5320) || (channel >= 5500 && channel <= 5700);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b != 0) {
+        uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+GScanScheduler::GScanScheduler()
+    : mNumBuckets(0), mTimerPeriodMs(0), mHyperPeriod(0), mHyperPeriodCapped(false),
+      mNumChannels(0)
+{
+}
+
+int GScanScheduler::getBandChannels(wifi_band band, wifi_channel *channels, int maxChannels)
+{
+    int count = 0;
+
+    if (band & WIFI_BAND_BG) {
+        for (size_t i = 0; i < ARRAY_SIZE(sBgChannels) && count < maxChannels; i++) {
+            channels[count++] = sBgChannels[i];
+        }
+    }
+    if (band & WIFI_BAND_A) {
+        for (size_t i = 0; i < ARRAY_SIZE(sAChannels) && count < maxChannels; i++) {
+            channels[count++] = sAChannels[i];
+        }
+    }
+    if (band & WIFI_BAND_A_DFS) {
+        for (size_t i = 0; i < ARRAY_SIZE(sADfsChannels) && count < maxChannels; i++) {
+            channels[count++] = sADfsChannels[i];
+        }
+    }
+    return count;
+}
+
+int GScanScheduler::channelIndex(wifi_channel channel)
+{
+    for (int i = 0; i < mNumChannels; i++) {
+        if (mChannels[i] == channel) {
+            return i;
+        }
+    }
+    mChannels[mNumChannels] = channel;
+    return mNumChannels++;
+}
+
+void GScanScheduler::sortChannels()
+{
+    uint16_t order[MAX_SCHEDULE_CHANNELS];
+    uint16_t rank[MAX_SCHEDULE_CHANNELS];
+    wifi_channel sorted[MAX_SCHEDULE_CHANNELS];
+
+    // insertion sort: a few dozen channels, done once per init()
+    for (int i = 0; i < mNumChannels; i++) {
+        int j = i;
+        while (j > 0 && mChannels[order[j - 1]] > mChannels[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    for (int i = 0; i < mNumChannels; i++) {
+        sorted[i] = mChannels[order[i]];
+        rank[order[i]] = i;
+    }
+    memcpy(mChannels, sorted, mNumChannels * sizeof(mChannels[0]));
+    for (int b = 0; b < mNumBuckets; b++) {
+        for (int c = 0; c < mNumBucketChannels[b]; c++) {
+            mBucketChannels[b][c].index = rank[mBucketChannels[b][c].index];
+        }
+    }
+}
+
+wifi_error GScanScheduler::init(const wifi_scan_cmd_params& params)
+{
+    mNumBuckets = 0;
+    mNumChannels = 0;
+
+    if (params.base_period <= 0 || params.num_buckets <= 0 ||
+            params.num_buckets > (int)MAX_BUCKETS) {
+        ALOGE("invalid base period %d or number of buckets %d",
+              params.base_period, params.num_buckets);
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    uint64_t periodGcd = 0;
+    for (int b = 0; b < params.num_buckets; b++) {
+        const wifi_scan_bucket_spec& spec = params.buckets[b];
+        wifi_channel channels[MAX_BUCKET_CHANNELS];
+        int numChannels;
+
+        if (spec.period <= 0) {
+            ALOGE("bucket %d: invalid period %d", b, spec.period);
+            return WIFI_ERROR_INVALID_ARGS;
+        }
+        if (spec.band != WIFI_BAND_UNSPECIFIED) {
+            numChannels = getBandChannels(spec.band, channels, MAX_BUCKET_CHANNELS);
+        } else {
+            if (spec.num_channels <= 0 || spec.num_channels > (int)MAX_CHANNELS) {
+                ALOGE("bucket %d: invalid number of channels %d", b, spec.num_channels);
+                return WIFI_ERROR_INVALID_ARGS;
+            }
+            numChannels = spec.num_channels;
+            for (int c = 0; c < numChannels; c++) {
+                channels[c] = spec.channels[c].channel;
+            }
+        }
+
+        // a period too short for the base period is scanned as often as possible
+        uint32_t multiple = (spec.period + params.base_period / 2) / params.base_period;
+        mBucketTicks[b] = multiple > 0 ? multiple : 1;
+        periodGcd = gcd(mBucketTicks[b], periodGcd);
+        mReportEvents[b] = spec.report_events;
+
+        mNumBucketChannels[b] = 0;
+        mBucketDwellTimeMs[b] = 0;
+        for (int c = 0; c < numChannels; c++) {
+            bool passive = isDfsChannel(channels[c]);
+            int dwell = 0;
+            if (spec.band == WIFI_BAND_UNSPECIFIED) {
+                passive = passive || spec.channels[c].passive;
+                dwell = spec.channels[c].dwellTimeMs;
+            }
+            if (dwell <= 0) {
+                dwell = passive ? DEFAULT_PASSIVE_DWELL_MS : DEFAULT_ACTIVE_DWELL_MS;
+            }
+
+            int index = channelIndex(channels[c]);
+            // a channel listed twice in a bucket is scanned once
+            BucketChannel *bc = NULL;
+            for (int i = 0; i < mNumBucketChannels[b]; i++) {
+                if (mBucketChannels[b][i].index == index) {
+                    bc = &mBucketChannels[b][i];
+                    break;
+                }
+            }
+            if (bc == NULL) {
+                bc = &mBucketChannels[b][mNumBucketChannels[b]++];
+                bc->index = index;
+                bc->dwellTimeMs = 0;
+                bc->passive = true;
+            } else {
+                mBucketDwellTimeMs[b] -= bc->dwellTimeMs;
+            }
+            if (dwell > bc->dwellTimeMs) {
+                bc->dwellTimeMs = dwell;
+            }
+            bc->passive = bc->passive && passive;
+            mBucketDwellTimeMs[b] += bc->dwellTimeMs;
+        }
+        mNumBuckets++;
+    }
+
+    // tick on the GCD of the bucket periods, the timeline repeats every LCM
+    mTimerPeriodMs = params.base_period * periodGcd;
+    mHyperPeriod = 1;
+    mHyperPeriodCapped = false;
+    for (int b = 0; b < mNumBuckets; b++) {
+        mBucketTicks[b] /= periodGcd;
+    }
+    for (int b = 0; b < mNumBuckets; b++) {
+        uint64_t lcm = mHyperPeriod / gcd(mHyperPeriod, mBucketTicks[b]) * mBucketTicks[b];
+        if (lcm > MAX_HYPER_PERIOD) {
+            mHyperPeriod = MAX_HYPER_PERIOD;
+            mHyperPeriodCapped = true;
+            break;
+        }
+        mHyperPeriod = lcm;
+    }
+
+    sortChannels();
+    ALOGV("%d buckets, %d channels, timer %d ms, hyper period %llu ticks%s",
+          mNumBuckets, mNumChannels, mTimerPeriodMs, (unsigned long long)mHyperPeriod,
+          mHyperPeriodCapped ? " (capped)" : "");
+    return WIFI_SUCCESS;
+}
+
+void GScanScheduler::getTick(uint64_t n, Tick *tick) const
+{
+    uint64_t mask[CHANNEL_MASK_WORDS];
+    int dwell[MAX_SCHEDULE_CHANNELS];
+    bool passive[MAX_SCHEDULE_CHANNELS];
+
+    tick->index = n;
+    tick->bucketMask = 0;
+    tick->reportMask = 0;
+    tick->dwellTimeMs = 0;
+    tick->numChannels = 0;
+
+    memset(mask, 0, sizeof(mask));
+    for (int b = 0; b < mNumBuckets; b++) {
+        if (n % mBucketTicks[b] != 0) {
+            continue;
+        }
+        tick->bucketMask |= 1 << b;
+        if (mReportEvents[b] >= 1) {
+            tick->reportMask |= 1 << b;
+        }
+        for (int c = 0; c < mNumBucketChannels[b]; c++) {
+            const BucketChannel& bc = mBucketChannels[b][c];
+            uint64_t bit = 1ULL << (bc.index % 64);
+            if (!(mask[bc.index / 64] & bit)) {
+                mask[bc.index / 64] |= bit;
+                dwell[bc.index] = bc.dwellTimeMs;
+                passive[bc.index] = bc.passive;
+            } else {
+                if (bc.dwellTimeMs > dwell[bc.index]) {
+                    dwell[bc.index] = bc.dwellTimeMs;
+                }
+                passive[bc.index] = passive[bc.index] && bc.passive;
+            }
+        }
+    }
+
+    // channel indexes are in frequency order
+    for (uint32_t w = 0; w < CHANNEL_MASK_WORDS; w++) {
+        uint64_t bits = mask[w];
+        while (bits != 0) {
+            int index = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            ScanChannel *sc = &tick->channels[tick->numChannels++];
+            sc->channel = mChannels[index];
+            sc->dwellTimeMs = dwell[index];
+            sc->passive = passive[index];
+            tick->dwellTimeMs += dwell[index];
+        }
+    }
+}
+
+void GScanScheduler::getDutyCycle(DutyCycle *dutyCycle) const
+{
+    Tick tick;
+
+    memset(dutyCycle, 0, sizeof(*dutyCycle));
+    dutyCycle->ticks = mHyperPeriod;
+    for (uint64_t n = 0; n < mHyperPeriod; n++) {
+        getTick(n, &tick);
+        if (tick.bucketMask == 0) {
+            continue;
+        }
+        dutyCycle->scanTicks++;
+        dutyCycle->channelScans += tick.numChannels;
+        dutyCycle->dwellTimeMs += tick.dwellTimeMs;
+        for (int b = 0; b < mNumBuckets; b++) {
+            if (tick.bucketMask & (1 << b)) {
+                dutyCycle->bucketChannelScans += mNumBucketChannels[b];
+                dutyCycle->bucketDwellTimeMs += mBucketDwellTimeMs[b];
+            }
+        }
+    }
+}
+
+}; // namespace android_wifi_legacy
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GSCANSCHEDULER_H
+#define ANDROID_GSCANSCHEDULER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware_legacy/gscan.h>
+
+namespace android_wifi_legacy {
+
+// ----------------------------------------------------------------------------
+
+// GScanScheduler is the reference implementation of the GSCAN bucket scheduling: it turns
+// the buckets of a wifi_scan_cmd_params into the timeline of scans a firmware would run.
+//
+// Bucket periods are rounded to a multiple of base_period. The timer period is base_period
+// times the GCD of those multiples, so that no timer expires without a scan, and the
+// timeline repeats every hyper period, the LCM of the bucket periods. On each timer tick,
+// the channels of all the buckets due are merged: a channel shared by several buckets is
+// scanned once, with the longest dwell time asked for, and actively unless every bucket
+// asks for a passive scan. Channels are scanned in frequency order so that each band is
+// visited once per tick.
+//
+// All the state is in fixed size arrays sized by the gscan.h limits: init() does not
+// allocate and getTick() is O(channels).
+class GScanScheduler
+{
+public:
+    // channels of the bands, as a firmware without regulatory information would scan them
+    static const uint32_t NUM_BAND_CHANNELS = 35;
+    // channels of one bucket: its band or its channel list
+    static const uint32_t MAX_BUCKET_CHANNELS = NUM_BAND_CHANNELS;
+    // distinct channels of a schedule: band channels plus explicit channels
+    static const uint32_t MAX_SCHEDULE_CHANNELS = NUM_BAND_CHANNELS + MAX_BUCKETS * MAX_CHANNELS;
+    static const uint32_t CHANNEL_MASK_WORDS = (MAX_SCHEDULE_CHANNELS + 63) / 64;
+    // hyper periods are evaluated on at most this many ticks
+    static const uint64_t MAX_HYPER_PERIOD = 1 << 20;
+
+    static const int DEFAULT_ACTIVE_DWELL_MS = 30;
+    static const int DEFAULT_PASSIVE_DWELL_MS = 110;
+
+    struct ScanChannel {
+        wifi_channel channel;
+        int dwellTimeMs;
+        bool passive;
+    };
+
+    // the scans of one timer tick
+    struct Tick {
+        uint64_t index;                 // tick number, at index * timerPeriodMs()
+        uint32_t bucketMask;            // buckets due
+        uint32_t reportMask;            // buckets due with report_events >= 1
+        int dwellTimeMs;                // radio on time of the tick
+        int numChannels;
+        ScanChannel channels[MAX_SCHEDULE_CHANNELS];
+    };
+
+    struct DutyCycle {
+        uint64_t ticks;                 // ticks evaluated, the hyper period unless capped
+        uint64_t scanTicks;             // ticks with at least one bucket due
+        uint64_t channelScans;          // channels scanned after merging
+        uint64_t bucketChannelScans;    // channels scanned if each bucket ran on its own
+        uint64_t dwellTimeMs;           // radio on time after merging
+        uint64_t bucketDwellTimeMs;     // radio on time if each bucket ran on its own
+    };
+
+                        GScanScheduler();
+
+    // validates and compiles params, returns WIFI_ERROR_INVALID_ARGS if they are not valid
+    wifi_error          init(const wifi_scan_cmd_params& params);
+
+    int                 numBuckets() const { return mNumBuckets; }
+    int                 numChannels() const { return mNumChannels; }
+    int                 timerPeriodMs() const { return mTimerPeriodMs; }
+    // period of a bucket in timer ticks
+    uint32_t            bucketTicks(int bucket) const { return mBucketTicks[bucket]; }
+    // LCM of the bucket periods in timer ticks, MAX_HYPER_PERIOD if larger
+    uint64_t            hyperPeriod() const { return mHyperPeriod; }
+    bool                hyperPeriodCapped() const { return mHyperPeriodCapped; }
+
+    // fills tick with the merged scans of timer tick n
+    void                getTick(uint64_t n, Tick *tick) const;
+    // radio usage over one hyper period
+    void                getDutyCycle(DutyCycle *dutyCycle) const;
+
+    // channels of a band, returns the number of channels written
+    static int          getBandChannels(wifi_band band, wifi_channel *channels, int maxChannels);
+
+private:
+    struct BucketChannel {
+        uint16_t index;                 // index in mChannels
+        int dwellTimeMs;
+        bool passive;
+    };
+
+    int                 channelIndex(wifi_channel channel);
+    void                sortChannels();
+
+    int mNumBuckets;
+    int mTimerPeriodMs;
+    uint64_t mHyperPeriod;
+    bool mHyperPeriodCapped;
+
+    // distinct channels, sorted by frequency once init() is done
+    int mNumChannels;
+    wifi_channel mChannels[MAX_SCHEDULE_CHANNELS];
+
+    uint32_t mBucketTicks[MAX_BUCKETS];
+    byte mReportEvents[MAX_BUCKETS];
+    int mBucketDwellTimeMs[MAX_BUCKETS];
+    int mNumBucketChannels[MAX_BUCKETS];
+    BucketChannel mBucketChannels[MAX_BUCKETS][MAX_BUCKET_CHANNELS];
+};
+
+}; // namespace android_wifi_legacy
+
+#endif // ANDROID_GSCANSCHEDULER_H
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GScanSimulator"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "GScanSimulator.h"
+
+namespace android_wifi_legacy {
+
+GScanSimulator::GScanSimulator(uint32_t numAps, uint32_t seed)
+    : mNumAps(numAps), mSeed(seed != 0 ? seed : 1)
+{
+    int numChannels = GScanScheduler::getBandChannels(WIFI_BAND_ABG_WITH_DFS, mBandChannels,
+                                                      GScanScheduler::NUM_BAND_CHANNELS);
+
+    mAps = new Ap[numAps];
+    memset(mChannelFirst, 0, sizeof(mChannelFirst));
+
+    // most APs on 2.4 GHz, the rest spread over 5 GHz
+    uint32_t ap = 0;
+    for (int c = 0; c < numChannels; c++) {
+        mChannelFirst[c] = ap;
+        uint32_t count;
+        if (c == numChannels - 1) {
+            count = numAps - ap;
+        } else if (mBandChannels[c] < 5000) {
+            count = numAps * 6 / 10 / 11;
+        } else {
+            count = numAps * 4 / 10 / (numChannels - 11);
+        }
+        for (uint32_t i = 0; i < count && ap < numAps; i++, ap++) {
+            Ap *a = &mAps[ap];
+            uint32_t r = random();
+            a->bssid[0] = 0x02;         // locally administered
+            a->bssid[1] = (byte)(r >> 24);
+            a->bssid[2] = (byte)(r >> 16);
+            a->bssid[3] = (byte)(r >> 8);
+            a->bssid[4] = (byte)(ap >> 8);
+            a->bssid[5] = (byte)ap;
+            snprintf(a->ssid, sizeof(a->ssid), "sim-%u", ap);
+            a->channel = mBandChannels[c];
+            a->rssi = -35 - (int)(random() % 60);
+            a->beaconPeriod = 100;
+            a->capability = 0x0411;     // ESS, privacy, short slot time
+        }
+    }
+    mChannelFirst[numChannels] = numAps;
+}
+
+GScanSimulator::~GScanSimulator()
+{
+    delete[] mAps;
+}
+
+uint32_t GScanSimulator::random()
+{
+    // xorshift32, repeatable and independent from the libc generator
+    mSeed ^= mSeed << 13;
+    mSeed ^= mSeed >> 17;
+    mSeed ^= mSeed << 5;
+    return mSeed;
+}
+
+void GScanSimulator::getBssid(uint32_t ap, mac_addr bssid) const
+{
+    memcpy(bssid, mAps[ap].bssid, sizeof(mac_addr));
+}
+
+uint32_t GScanSimulator::scan(const GScanScheduler::Tick& tick, wifi_timestamp ts,
+                              Listener *listener)
+{
+    uint32_t numResults = 0;
+    wifi_timestamp now = ts;
+
+    for (int i = 0; i < tick.numChannels; i++) {
+        const GScanScheduler::ScanChannel& sc = tick.channels[i];
+        int c = 0;
+        while (c < (int)GScanScheduler::NUM_BAND_CHANNELS && mBandChannels[c] != sc.channel) {
+            c++;
+        }
+        if (c < (int)GScanScheduler::NUM_BAND_CHANNELS) {
+            for (uint32_t ap = mChannelFirst[c]; ap < mChannelFirst[c + 1]; ap++) {
+                const Ap& a = mAps[ap];
+                uint32_t r = random();
+                if (r % MISS_RATE == 0) {
+                    continue;
+                }
+                wifi_scan_result *result = &mResult;
+                size_t ssidLen = strlen(a.ssid);
+                byte *ie = (byte *)result->ie_data;
+
+                result->ts = now;
+                memcpy(result->ssid, a.ssid, ssidLen + 1);
+                memcpy(result->bssid, a.bssid, sizeof(mac_addr));
+                result->channel = a.channel;
+                result->rssi = a.rssi + (int)((r >> 8) % (2 * RSSI_NOISE_DB + 1)) -
+                        RSSI_NOISE_DB;
+                result->rtt = 0;
+                result->rtt_sd = 0;
+                result->beacon_period = a.beaconPeriod;
+                result->capability = a.capability;
+
+                // SSID, supported rates and, on 2.4 GHz, DS parameter set
+                *ie++ = 0;
+                *ie++ = ssidLen;
+                memcpy(ie, a.ssid, ssidLen);
+                ie += ssidLen;
+                static const byte rates[] = { 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24 };
+                *ie++ = 1;
+                *ie++ = sizeof(rates);
+                memcpy(ie, rates, sizeof(rates));
+                ie += sizeof(rates);
+                if (a.channel < 5000) {
+                    *ie++ = 3;
+                    *ie++ = 1;
+                    *ie++ = (a.channel - 2407) / 5;
+                }
+                result->ie_length = ie - (byte *)result->ie_data;
+
+                listener->onScanResult(*result);
+                numResults++;
+            }
+        }
+        now += sc.dwellTimeMs * 1000LL;
+    }
+    listener->onScanComplete(tick, now);
+    return numResults;
+}
+
+}; // namespace android_wifi_legacy
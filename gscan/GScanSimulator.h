@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GSCANSIMULATOR_H
+#define ANDROID_GSCANSIMULATOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware_legacy/gscan.h>
+
+#include "GScanScheduler.h"
+
+namespace android_wifi_legacy {
+
+// ----------------------------------------------------------------------------
+
+// GScanSimulator is a scan backend producing synthetic results: a fixed set of access
+// points spread over the band channels, each seen with its own RSSI plus some noise and
+// missed now and then, as in a real environment. It scans the channels of a
+// GScanScheduler::Tick and hands each result to a Listener. The results are repeatable
+// for a given seed.
+class GScanSimulator
+{
+public:
+    // size of the information elements of a result: SSID, rates and DS parameter set
+    static const uint32_t MAX_IE_LENGTH = 2 + 32 + 2 + 8 + 2 + 1;
+    // one AP in this many is missed by each scan of its channel
+    static const uint32_t MISS_RATE = 20;
+    static const int RSSI_NOISE_DB = 4;
+
+    class Listener
+    {
+    public:
+        virtual         ~Listener() {}
+        // result, with its ie_data, is only valid during the call
+        virtual void    onScanResult(const wifi_scan_result& result) = 0;
+        // called after the channels of a tick have been scanned
+        virtual void    onScanComplete(const GScanScheduler::Tick& tick, wifi_timestamp ts) = 0;
+    };
+
+                        GScanSimulator(uint32_t numAps, uint32_t seed);
+                        ~GScanSimulator();
+
+    uint32_t            numAps() const { return mNumAps; }
+    // BSSID of an AP of the simulated environment
+    void                getBssid(uint32_t ap, mac_addr bssid) const;
+
+    // scans the channels of tick, which starts at ts, and returns the number of results
+    uint32_t            scan(const GScanScheduler::Tick& tick, wifi_timestamp ts,
+                             Listener *listener);
+
+private:
+    struct Ap {
+        mac_addr bssid;
+        char ssid[32 + 1];
+        wifi_channel channel;
+        wifi_rssi rssi;
+        unsigned short beaconPeriod;
+        unsigned short capability;
+    };
+
+    uint32_t            random();
+
+    uint32_t mNumAps;
+    uint32_t mSeed;
+    // APs sorted by channel, mChannelFirst[i] is the first AP on the i-th band channel
+    Ap *mAps;
+    uint32_t mChannelFirst[GScanScheduler::NUM_BAND_CHANNELS + 1];
+    wifi_channel mBandChannels[GScanScheduler::NUM_BAND_CHANNELS];
+    // a wifi_scan_result followed by room for its information elements
+    union {
+        wifi_scan_result mResult;
+        char mResultBuffer[sizeof(wifi_scan_result) + MAX_IE_LENGTH];
+    };
+};
+
+}; // namespace android_wifi_legacy
+
+#endif // ANDROID_GSCANSIMULATOR_H
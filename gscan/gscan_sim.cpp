@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// gscan_sim: runs the reference GSCAN engine on a scan configuration against the
+// simulated environment of GScanSimulator, and reports the merged timeline, the radio
+// on time saved by merging buckets, the behaviour of the scan cache and of the BSSID
+// hotlist, and the cost of the engine itself. It is the baseline vendor implementations
+// are measured against. Each report_threshold wakeup reads the cache and flushes it, as
+// the framework does. The hotlist is made of APs of the simulated environment, and is
+// also timed on its own against full band scans.
+//
+// Configuration syntax, one statement per line, '#' starts a comment:
+//   base_period <ms>                   wifi_scan_cmd_params.base_period
+//   max_ap_per_scan <count>            wifi_scan_cmd_params.max_ap_per_scan
+//   report_threshold <percent>         wifi_scan_cmd_params.report_threshold
+//   bucket <period ms> <channels> [report_events]
+// <channels> is a band name (bg, a, a_dfs, a_with_dfs, abg, abg_with_dfs) or a ','
+// separated list of frequencies in MHz, each optionally followed by ':<dwell ms>' and
+// ':p' for a passive scan, e.g. 2412,2437:40,5500:110:p
+
+#define LOG_TAG "gscan_sim"
+//#define LOG_NDEBUG 0
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "GScanCache.h"
+#include "GScanHotlist.h"
+#include "GScanScheduler.h"
+#include "GScanSimulator.h"
+
+namespace android_wifi_legacy {
+
+static int64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// hotlist thresholds and loss sample size
+static const wifi_rssi HOTLIST_LOW = -80;
+static const wifi_rssi HOTLIST_HIGH = -70;
+static const int HOTLIST_LOST_SAMPLE_SIZE = 3;
+// full band scans timed against the hotlist
+static const int HOTLIST_BENCH_SCANS = 1000;
+
+static uint64_t sFoundEvents;
+static uint64_t sLostEvents;
+
+static void onHotlistApFound(wifi_request_id id, unsigned num_results, wifi_scan_result *results)
+{
+    sFoundEvents++;
+}
+
+static void onHotlistApLost(wifi_request_id id, unsigned num_results, wifi_scan_result *results)
+{
+    sLostEvents++;
+}
+
+static const struct {
+    const char *name;
+    wifi_band band;
+} sBandNames[] = {
+    { "bg",             WIFI_BAND_BG },
+    { "a",              WIFI_BAND_A },
+    { "a_dfs",          WIFI_BAND_A_DFS },
+    { "a_with_dfs",     WIFI_BAND_A_WITH_DFS },
+    { "abg",            WIFI_BAND_ABG },
+    { "abg_with_dfs",   WIFI_BAND_ABG_WITH_DFS },
+};
+
+static bool parseChannels(char *arg, wifi_scan_bucket_spec *spec)
+{
+    for (size_t i = 0; i < sizeof(sBandNames) / sizeof(sBandNames[0]); i++) {
+        if (strcmp(arg, sBandNames[i].name) == 0) {
+            spec->band = sBandNames[i].band;
+            return true;
+        }
+    }
+    spec->band = WIFI_BAND_UNSPECIFIED;
+    spec->num_channels = 0;
+    char *save;
+    for (char *channel = strtok_r(arg, ",", &save); channel != NULL;
+            channel = strtok_r(NULL, ",", &save)) {
+        if (spec->num_channels == (int)MAX_CHANNELS) {
+            return false;
+        }
+        wifi_scan_channel_spec *cs = &spec->channels[spec->num_channels++];
+        char *end;
+        cs->channel = strtol(channel, &end, 10);
+        cs->dwellTimeMs = 0;
+        cs->passive = 0;
+        while (*end == ':') {
+            if (end[1] == 'p') {
+                cs->passive = 1;
+                end += 2;
+            } else {
+                cs->dwellTimeMs = strtol(end + 1, &end, 10);
+            }
+        }
+        if (*end != '\0' || cs->channel <= 0) {
+            return false;
+        }
+    }
+    return spec->num_channels > 0;
+}
+
+static bool loadConfig(const char *path, wifi_scan_cmd_params *params)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+
+    memset(params, 0, sizeof(*params));
+    char line[512];
+    int lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *args[5];
+        int numArgs = 0;
+        char *save;
+        for (char *arg = strtok_r(line, " \t\r\n", &save); arg != NULL && numArgs < 5;
+                arg = strtok_r(NULL, " \t\r\n", &save)) {
+            args[numArgs++] = arg;
+        }
+        if (numArgs == 0) {
+            continue;
+        }
+        if (strcmp(args[0], "base_period") == 0 && numArgs == 2) {
+            params->base_period = atoi(args[1]);
+        } else if (strcmp(args[0], "max_ap_per_scan") == 0 && numArgs == 2) {
+            params->max_ap_per_scan = atoi(args[1]);
+        } else if (strcmp(args[0], "report_threshold") == 0 && numArgs == 2) {
+            params->report_threshold = atoi(args[1]);
+        } else if (strcmp(args[0], "bucket") == 0 && (numArgs == 3 || numArgs == 4) &&
+                params->num_buckets < (int)MAX_BUCKETS) {
+            wifi_scan_bucket_spec *spec = &params->buckets[params->num_buckets];
+            spec->bucket = params->num_buckets;
+            spec->period = atoi(args[1]);
+            spec->report_events = numArgs == 4 ? atoi(args[3]) : 0;
+            ok = parseChannels(args[2], spec);
+            params->num_buckets++;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s:%d: syntax error\n", path, lineNumber);
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+// Counts what the simulated firmware produces and feeds the scan cache.
+class SimListener : public GScanSimulator::Listener
+{
+public:
+    SimListener(GScanCache *cache, GScanHotlist *hotlist)
+        : mCache(cache), mHotlist(hotlist), mResults(0), mScans(0), mCompletionEvents(0), mFlushedResults(0),
+          mFlushNs(0)
+    {
+    }
+
+    virtual void onScanResult(const wifi_scan_result& result)
+    {
+        mResults++;
+        if (mCache != NULL) {
+            mCache->addResult(result);
+        }
+        if (mHotlist != NULL) {
+            mHotlist->onScanResult(result);
+        }
+    }
+
+    virtual void onScanComplete(const GScanScheduler::Tick& tick, wifi_timestamp ts)
+    {
+        mScans++;
+        if (tick.reportMask != 0) {
+            mCompletionEvents++;
+        }
+        if (mCache != NULL && mCache->endScan()) {
+            // on_scan_results_available: read the history in place, then flush it
+            int64_t start = nowNs();
+            GScanCache::Iterator it = mCache->results();
+            const wifi_scan_result *result;
+            while ((result = it.next()) != NULL) {
+                mFlushedResults++;
+            }
+            mCache->flush();
+            mFlushNs += nowNs() - start;
+        }
+        if (mHotlist != NULL) {
+            mHotlist->endScan();
+        }
+    }
+
+    GScanCache *mCache;
+    GScanHotlist *mHotlist;
+    uint64_t mResults;
+    uint64_t mScans;
+    uint64_t mCompletionEvents;
+    uint64_t mFlushedResults;
+    int64_t mFlushNs;
+};
+
+// Keeps the results of a scan, without their information elements.
+class CollectListener : public GScanSimulator::Listener
+{
+public:
+    CollectListener(wifi_scan_result *results, uint32_t max)
+        : mResults(results), mMax(max), mNumResults(0)
+    {
+    }
+
+    virtual void onScanResult(const wifi_scan_result& result)
+    {
+        if (mNumResults < mMax) {
+            memcpy(&mResults[mNumResults], &result, sizeof(wifi_scan_result));
+            mResults[mNumResults++].ie_length = 0;
+        }
+    }
+
+    virtual void onScanComplete(const GScanScheduler::Tick& tick, wifi_timestamp ts) {}
+
+    wifi_scan_result *mResults;
+    uint32_t mMax;
+    uint32_t mNumResults;
+};
+
+// hotlist of numHotlistAps APs spread over the simulated environment
+static void getHotlistParams(const GScanSimulator& simulator, int numHotlistAps,
+                             wifi_bssid_hotlist_params *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->lost_ap_sample_size = HOTLIST_LOST_SAMPLE_SIZE;
+    params->num_ap = numHotlistAps;
+    for (int i = 0; i < numHotlistAps; i++) {
+        ap_threshold_param *ap = &params->ap[i];
+        simulator.getBssid((uint64_t)i * simulator.numAps() / numHotlistAps, ap->bssid);
+        ap->low = HOTLIST_LOW;
+        ap->high = HOTLIST_HIGH;
+    }
+}
+
+// times the hotlist alone against full band scans of the simulated environment
+static void benchHotlist(GScanSimulator& simulator, int numHotlistAps)
+{
+    wifi_scan_cmd_params scanParams;
+    memset(&scanParams, 0, sizeof(scanParams));
+    scanParams.base_period = 1000;
+    scanParams.num_buckets = 1;
+    scanParams.buckets[0].band = WIFI_BAND_ABG_WITH_DFS;
+    scanParams.buckets[0].period = 1000;
+
+    GScanScheduler scheduler;
+    GScanScheduler::Tick tick;
+    scheduler.init(scanParams);
+    scheduler.getTick(0, &tick);
+
+    wifi_scan_result *results = new wifi_scan_result[simulator.numAps()];
+    CollectListener collector(results, simulator.numAps());
+    simulator.scan(tick, 0, &collector);
+
+    wifi_bssid_hotlist_params params;
+    wifi_hotlist_ap_found_handler handler = { onHotlistApFound, onHotlistApLost };
+    GScanHotlist hotlist;
+    getHotlistParams(simulator, numHotlistAps, &params);
+    hotlist.init(1, params, handler);
+
+    int64_t start = nowNs();
+    for (int n = 0; n < HOTLIST_BENCH_SCANS; n++) {
+        hotlist.beginScan(&tick);
+        for (uint32_t i = 0; i < collector.mNumResults; i++) {
+            hotlist.onScanResult(results[i]);
+        }
+        hotlist.endScan();
+    }
+    int64_t ns = nowNs() - start;
+
+    printf("hotlist of %d APs against %u results per scan:\n", numHotlistAps,
+           collector.mNumResults);
+    printf("  match:       %.1f ns per scan, %.1f ns per result\n",
+           (double)ns / HOTLIST_BENCH_SCANS,
+           collector.mNumResults ?
+                   (double)ns / HOTLIST_BENCH_SCANS / collector.mNumResults : 0.0);
+    delete[] results;
+}
+
+static void run(const wifi_scan_cmd_params& params, uint32_t numAps, int durationS,
+                int cacheScans, size_t cacheSize, int numHotlistAps, bool verbose)
+{
+    GScanScheduler scheduler;
+    if (scheduler.init(params) != WIFI_SUCCESS) {
+        fprintf(stderr, "invalid scan configuration\n");
+        return;
+    }
+
+    printf("timer period:  %d ms\n", scheduler.timerPeriodMs());
+    printf("hyper period:  %llu ticks, %.1f s%s\n",
+           (unsigned long long)scheduler.hyperPeriod(),
+           scheduler.hyperPeriod() * scheduler.timerPeriodMs() / 1000.0,
+           scheduler.hyperPeriodCapped() ? " (capped)" : "");
+    printf("channels:      %d\n", scheduler.numChannels());
+    for (int b = 0; b < scheduler.numBuckets(); b++) {
+        printf("bucket %2d:     every %u ticks (%d ms asked)\n", b, scheduler.bucketTicks(b),
+               params.buckets[b].period);
+    }
+
+    GScanScheduler::DutyCycle dc;
+    scheduler.getDutyCycle(&dc);
+    printf("per hyper period:\n");
+    printf("  scans:       %llu of %llu ticks\n",
+           (unsigned long long)dc.scanTicks, (unsigned long long)dc.ticks);
+    printf("  channels:    %llu merged, %llu per bucket\n",
+           (unsigned long long)dc.channelScans, (unsigned long long)dc.bucketChannelScans);
+    printf("  radio on:    %llu ms merged, %llu ms per bucket, %.1f%% saved, duty cycle %.2f%%\n",
+           (unsigned long long)dc.dwellTimeMs, (unsigned long long)dc.bucketDwellTimeMs,
+           dc.bucketDwellTimeMs ?
+                   100.0 * (dc.bucketDwellTimeMs - dc.dwellTimeMs) / dc.bucketDwellTimeMs : 0.0,
+           100.0 * dc.dwellTimeMs / ((double)dc.ticks * scheduler.timerPeriodMs()));
+
+    GScanCache cache;
+    bool cached = cache.init(params, cacheScans, cacheSize) == WIFI_SUCCESS;
+    if (!cached) {
+        printf("no scan cache\n");
+    }
+
+    GScanSimulator simulator(numAps, 1);
+    GScanHotlist hotlist;
+    if (numHotlistAps > 0) {
+        wifi_bssid_hotlist_params hotlistParams;
+        wifi_hotlist_ap_found_handler handler = { onHotlistApFound, onHotlistApLost };
+        getHotlistParams(simulator, numHotlistAps, &hotlistParams);
+        hotlist.init(1, hotlistParams, handler);
+    }
+    SimListener listener(cached ? &cache : NULL, numHotlistAps > 0 ? &hotlist : NULL);
+    GScanScheduler::Tick tick;
+    uint64_t numTicks = (uint64_t)durationS * 1000 / scheduler.timerPeriodMs();
+    int64_t scheduleNs = 0, scanNs = 0;
+
+    for (uint64_t n = 0; n < numTicks; n++) {
+        int64_t start = nowNs();
+        scheduler.getTick(n, &tick);
+        int64_t scheduled = nowNs();
+        scheduleNs += scheduled - start;
+        if (tick.bucketMask == 0) {
+            continue;
+        }
+        wifi_timestamp ts = (wifi_timestamp)n * scheduler.timerPeriodMs() * 1000;
+        if (cached) {
+            cache.beginScan(ts);
+        }
+        if (numHotlistAps > 0) {
+            hotlist.beginScan(&tick);
+        }
+        uint32_t results = simulator.scan(tick, ts, &listener);
+        scanNs += nowNs() - scheduled;
+        if (verbose) {
+            printf("%10.3f s: buckets 0x%04x, %d channels, %d ms, %u results\n",
+                   ts / 1e6, tick.bucketMask, tick.numChannels, tick.dwellTimeMs, results);
+        }
+    }
+
+    printf("simulated %d s with %u APs:\n", durationS, numAps);
+    printf("  scans:       %llu, %llu completion events\n",
+           (unsigned long long)listener.mScans, (unsigned long long)listener.mCompletionEvents);
+    printf("  results:     %llu\n", (unsigned long long)listener.mResults);
+    printf("  scheduler:   %.1f ns per tick\n", numTicks ? (double)scheduleNs / numTicks : 0.0);
+    printf("  simulator:   %.1f ns per result, cache included\n",
+           listener.mResults ? (double)scanNs / listener.mResults : 0.0);
+
+    if (cached) {
+        const GScanCache::Stats& stats = cache.stats();
+        printf("scan cache of %d scans, %d results, %zu bytes:\n",
+               cacheScans, cache.capacity(), cache.arenaSize());
+        printf("  stored:      %llu replaced, %llu rejected, %llu truncated, %llu no memory\n",
+               (unsigned long long)stats.replaced, (unsigned long long)stats.rejected,
+               (unsigned long long)stats.truncated, (unsigned long long)stats.noMemory);
+        printf("  scans:       %llu evicted, %llu before a report\n",
+               (unsigned long long)stats.evictedScans, (unsigned long long)stats.bufferFull);
+        printf("  wakeups:     %llu at %d%%, %llu results read\n",
+               (unsigned long long)stats.wakeups, params.report_threshold,
+               (unsigned long long)listener.mFlushedResults);
+        printf("  arena:       %zu bytes peak\n", cache.peakUsedSize());
+        printf("  flush:       %.1f ns per result\n", listener.mFlushedResults ?
+               (double)listener.mFlushNs / listener.mFlushedResults : 0.0);
+    }
+
+    if (numHotlistAps > 0) {
+        printf("hotlist of %d APs, RSSI %d..%d dB, lost after %d scans:\n", numHotlistAps,
+               HOTLIST_LOW, HOTLIST_HIGH, HOTLIST_LOST_SAMPLE_SIZE);
+        printf("  found:       %llu APs in %llu events\n",
+               (unsigned long long)hotlist.numFound(), (unsigned long long)sFoundEvents);
+        printf("  lost:        %llu APs in %llu events\n",
+               (unsigned long long)hotlist.numLost(), (unsigned long long)sLostEvents);
+        benchHotlist(simulator, numHotlistAps);
+    }
+}
+
+}; // namespace android_wifi_legacy
+
+using namespace android_wifi_legacy;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-a aps] [-d seconds] [-c scans] [-m bytes] [-H aps] [-v] config\n"
+                    "  -a aps      access points of the simulated environment, default 500\n"
+                    "  -d seconds  simulated time, default 3600\n"
+                    "  -c scans    scans in the scan cache, default 16\n"
+                    "  -m bytes    size of the scan cache, default 65536\n"
+                    "  -H aps      APs in the BSSID hotlist, default 128, 0 for none\n"
+                    "  -v          print every scan\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t numAps = 500;
+    int durationS = 3600;
+    int cacheScans = 16;
+    size_t cacheSize = 65536;
+    int numHotlistAps = MAX_HOTLIST_APS;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:d:c:m:H:v")) != -1) {
+        switch (opt) {
+        case 'a':
+            numAps = atoi(optarg);
+            break;
+        case 'd':
+            durationS = atoi(optarg);
+            break;
+        case 'c':
+            cacheScans = atoi(optarg);
+            break;
+        case 'm':
+            cacheSize = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            numHotlistAps = atoi(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || numAps == 0 || durationS <= 0 ||
+            numHotlistAps < 0 || numHotlistAps > (int)MAX_HOTLIST_APS ||
+            (uint32_t)numHotlistAps > numAps) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    wifi_scan_cmd_params params;
+    if (!loadConfig(argv[optind], &params)) {
+        return 1;
+    }
+    run(params, numAps, durationS, cacheScans, cacheSize, numHotlistAps, verbose);
+    return 0;
+}
@@ -56,6 +56,9 @@ namespace android_audio_legacy {
 // Can be overridden by the audio.offload.min.duration.secs property
 #define OFFLOAD_DEFAULT_MIN_DURATION_SECS 60
 
+// bit of a routing strategy in strategy masks
+#define STRATEGY_MASK(strategy) (1 << (strategy))
+
 // ----------------------------------------------------------------------------
 // AudioPolicyManagerBase implements audio policy manager behavior common to all platforms.
 // Each platform must implement an AudioPolicyManager class derived from AudioPolicyManagerBase
@@ -72,7 +75,10 @@ class AudioPolicyManagerBase: public AudioPolicyInterface
 {
 
 public:
-                AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface);
+                // configFile, if not NULL, is tried before the vendor and system
+                // audio_policy.conf files. Used by off-device tools like audio_policy_sim.
+                AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface,
+                                       const char *configFile = NULL);
         virtual ~AudioPolicyManagerBase();
 
         // AudioPolicyInterface
@@ -148,6 +154,26 @@ public:
 
         virtual bool isOffloadSupported(const audio_offload_info_t& offloadInfo);
 
+        // Device connection transactions: between beginDeviceConnectionChanges() and
+        // commitDeviceConnectionChanges(), setDeviceConnectionState() only updates the available
+        // devices and opens or closes the outputs and inputs they need. Routing is evaluated once
+        // on commit for the final set of devices and, when the transaction holds more than one
+        // change, only outputs whose device changed are rerouted. A device disconnected and
+        // connected again gets a new output. Used when several devices appear or vanish at once,
+        // e.g. a dock exposing a headset, HDMI and USB audio. No other policy call may be made
+        // during a transaction.
+        void beginDeviceConnectionChanges();
+        status_t commitDeviceConnectionChanges();
+
+        struct DeviceConnectionChange {
+            audio_devices_t mDevice;
+            AudioSystem::device_connection_state mState;
+            const char *mAddress;
+        };
+        // applies count connection changes in one transaction. All changes are attempted, the
+        // status of the first one that failed is returned.
+        status_t setDeviceConnectionStates(const DeviceConnectionChange *changes, size_t count);
+
 protected:
 
         enum routing_strategy {
@@ -160,6 +186,9 @@ protected:
             NUM_STRATEGIES
         };
 
+        // mask of all routing strategies, see checkOutputForStrategies()
+        enum { STRATEGY_MASK_ALL = (1 << NUM_STRATEGIES) - 1 };
+
         // 4 points to define the volume attenuation curve, each characterized by the volume
         // index (from 0 to 100) at which they apply, and the attenuation in dB at that index.
         // we use 100 steps to avoid rounding errors when computing the volume in volIndexToAmpl()
@@ -430,6 +459,11 @@ protected:
         // close an output and its companion duplicating output.
         void closeOutput(audio_io_handle_t output);
 
+        // setDeviceConnectionState() without the routing update done on transaction commit
+        status_t updateDeviceConnectionState(audio_devices_t device,
+                                             AudioSystem::device_connection_state state,
+                                             const char *device_address);
+
         // checks and if necessary changes outputs used for all strategies.
         // must be called every time a condition that affects the output choice for a given strategy
         // changes: connected device, phone state, force use...
@@ -438,6 +472,11 @@ protected:
 
         // Same as checkOutputForStrategy() but for a all strategies in order of priority
         void checkOutputForAllStrategies();
+        // Same as checkOutputForAllStrategies() but only for the strategies in the mask. Strategies
+        // whose device did not change are skipped if no output was opened or closed.
+        void checkOutputForStrategies(uint32_t strategies);
+        // returns the mask of strategies whose device can depend on the forced config for usage
+        static uint32_t getStrategiesForForceUse(AudioSystem::force_use usage);
 
         // manages A2DP output suspend/restore according to phone state and BT SCO usage
         void checkA2dpSuspend();
@@ -572,6 +611,17 @@ protected:
 
         Vector <HwModule *> mHwModules;
 
+        // device connection transaction state, see beginDeviceConnectionChanges()
+        bool mDeviceConnectionBatch;        // true while a transaction is open
+        bool mBatchOutputDevicesChanged;    // output routing must be evaluated on commit
+        bool mBatchInputDevicesChanged;     // inputs must be closed on commit
+        int mBatchOutputChanges;            // output devices connected or disconnected
+        // mOutputs and the device of each output when the transaction was opened
+        DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> mBatchPreviousOutputs;
+        KeyedVector<audio_io_handle_t, audio_devices_t> mBatchOutputDevices;
+        SortedVector<audio_io_handle_t> mBatchClosedOutputs;  // outputs of disconnected devices
+        SortedVector<audio_io_handle_t> mBatchProbedOutputs;  // outputs opened for new devices
+
 #ifdef AUDIO_POLICY_TEST
         Mutex   mLock;
         Condition mWaitWorkCV;
@@ -30,9 +30,44 @@ enum {
 
 // while you have a lock held, the device will stay on at least at the
 // level you request.
+// Locks are counted per id within the process: the lock is released once every
+// acquire_wake_lock() of the id has been matched by a release_wake_lock().
 int acquire_wake_lock(int lock, const char* id);
 int release_wake_lock(const char* id);
 
+// Acquires a partial wake lock released automatically after timeout_ms. Calling it again
+// for an id with a pending timeout moves the deadline instead of adding a holder.
+// The kernel timeout is also set when the lock is taken by this call, so that the lock
+// does not outlive a crashed process.
+int acquire_wake_lock_timeout(const char* id, long timeout_ms);
+
+// In async mode, acquire_wake_lock() and release_wake_lock() never write to sysfs on the
+// caller's thread: the kernel lock is taken or dropped shortly after by a writer thread,
+// and a release followed by an acquire of the same id within a few ms cancel out.
+// Disabling async mode waits for pending transitions to be written.
+// Returns 0 on success.
+int set_wake_lock_async(int enable);
+
+struct wake_lock_stats {
+    int64_t total_held_ns;      // time held by this process, including the current hold
+    int64_t max_held_ns;        // longest hold, including the current one
+    uint32_t acquire_count;     // acquire_wake_lock() and acquire_wake_lock_timeout() calls
+    int holders;                // acquires not yet released
+    int max_holders;            // most acquires held at the same time
+    int last_tid;               // thread of the last acquire
+};
+
+// returns 0 on success, -1 if the id was never acquired by this process
+int get_wake_lock_stats(const char* id, struct wake_lock_stats* stats);
+
+enum {
+    WAKE_LOCK_DUMP_TEXT = 0,    // one line per id
+    WAKE_LOCK_DUMP_BINARY = 1   // per id: struct wake_lock_stats, uint32_t id length, id
+};
+
+// writes the stats of every id acquired by this process to fd, returns 0 on success
+int dump_wake_locks(int fd, int format);
+
 
 #if __cplusplus
 } // extern "C"
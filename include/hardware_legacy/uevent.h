@@ -17,17 +17,139 @@
 #ifndef _HARDWARE_UEVENT_H
 #define _HARDWARE_UEVENT_H
 
+#include <stdint.h>
+
 #if __cplusplus
 extern "C" {
 #endif
 
+/* largest uevent message received by the dispatcher */
+#define UEVENT_MSG_LEN 2048
+
+/* fields parsed per event, the kernel's UEVENT_NUM_ENVP */
+#define UEVENT_MAX_FIELDS 64
+#define UEVENT_HASH_BUCKETS 32
+#define UEVENT_NO_FIELD 0xff
+
+/* A KEY=value string of a uevent. Spans point into the receive buffer and are not NUL
+ * terminated at key_len, values are NUL terminated. */
+struct uevent_field {
+    const char *key;
+    const char *value;
+    unsigned short key_len;
+    unsigned short value_len;
+    unsigned int hash;
+    /* next field in the same hash bucket, UEVENT_NO_FIELD if none */
+    unsigned char next;
+};
+
+/*
+ * Parsed view of a received uevent, built once per event and shared by all handlers.
+ * It is only valid during the handler call.
+ */
+struct uevent_event {
+    const char *msg;
+    int msg_len;
+    /* common keys, NULL when absent */
+    const char *action;
+    const char *subsystem;
+    const char *devpath;
+    int num_fields;
+    struct uevent_field fields[UEVENT_MAX_FIELDS];
+    unsigned char buckets[UEVENT_HASH_BUCKETS];
+};
+
+/* uevent trace file: a header followed by records, each followed by its message */
+#define UEVENT_TRACE_MAGIC 0x54564555 /* "UEVT" */
+#define UEVENT_TRACE_VERSION 1
+
+struct uevent_trace_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct uevent_trace_record {
+    int64_t timestamp_ns;   /* CLOCK_MONOTONIC when the event was dispatched */
+    uint32_t msg_len;
+    uint32_t reserved;
+};
+
 int uevent_init();
+/*
+ * Alternative to uevent_init() for tests and benchmarks: events are read from an
+ * in-process socket fed by uevent_inject() or uevent_replay_trace() instead of the
+ * kernel. Everything else, including handlers and the dispatcher, works the same way.
+ * Returns 0 on failure, 1 on success.
+ */
+int uevent_init_injector();
+/*
+ * Queues one event, blocking while the socket is full. Returns 0 on success, -1 on error.
+ * As with kernel events, the socket filter of uevent_set_high_throughput() drops a short
+ * event without a SUBSYSTEM key.
+ */
+int uevent_inject(const char *msg, int msg_len);
+/*
+ * Injects the events of a trace written by uevent_start_recording(), with their original
+ * spacing if realtime is set or as fast as they are consumed otherwise.
+ * Returns the number of events injected, -1 on error.
+ */
+int uevent_replay_trace(const char *path, int realtime);
+/* Returns an fd positioned on the first record, -1 if path is not a uevent trace. */
+int uevent_open_trace(const char *path);
+/* Reads the next record and its message. Returns 1 on success, 0 at the end, -1 on error. */
+int uevent_read_trace(int trace_fd, struct uevent_trace_record *record,
+                      char *msg, int msg_len);
+/* Appends every dispatched event to a trace file. Returns 0 on success, -1 on error. */
+int uevent_start_recording(const char *path);
+void uevent_stop_recording();
 int uevent_get_fd();
 int uevent_next_event(char* buffer, int buffer_length);
 int uevent_add_native_handler(void (*handler)(void *data, const char *msg, int msg_len),
                               void *handler_data);
+/*
+ * Same as uevent_add_native_handler() but the handler is only called for events whose
+ * SUBSYSTEM and ACTION match subsystem and action. NULL matches any value.
+ */
+int uevent_add_filtered_native_handler(const char *subsystem, const char *action,
+                                       void (*handler)(void *data, const char *msg, int msg_len),
+                                       void *handler_data);
+/*
+ * Handlers are called without any lock held and may add or remove handlers. Removal
+ * waits for the dispatches in progress: once it returns, the removed handler is not
+ * running and will not be called again. The one exception is a removal from a handler,
+ * which does not wait, so the dispatch that called the handler may still call the
+ * removed handler. Callers must not hold a lock the handlers take while removing.
+ */
 int uevent_remove_native_handler(void (*handler)(void *data, const char *msg, int msg_len));
 
+/*
+ * Same as uevent_add_filtered_native_handler() but the handler receives the parsed event
+ * instead of the raw message.
+ */
+int uevent_add_event_handler(const char *subsystem, const char *action,
+                             void (*handler)(void *data, const struct uevent_event *event),
+                             void *handler_data);
+int uevent_remove_event_handler(void (*handler)(void *data, const struct uevent_event *event));
+/* Returns the value of the first field named key, or NULL. */
+const char *uevent_event_get(const struct uevent_event *event, const char *key);
+
+/*
+ * Starts a thread receiving uevents and calling the registered handlers, for processes
+ * that do not want to run their own uevent_next_event() loop. The two must not be used
+ * at the same time. Returns 0 on success, -1 on error.
+ */
+int uevent_start_dispatcher();
+void uevent_stop_dispatcher();
+
+/*
+ * High throughput mode for event bursts such as USB hub enumeration: enlarges the socket
+ * receive buffer and, when every registered handler is filtered on a subsystem, attaches
+ * a socket filter dropping the events of other subsystems in the kernel. The filter
+ * follows handler registrations and also applies to uevent_next_event().
+ * Returns 0 on success, -1 on error.
+ */
+int uevent_set_high_throughput(int enable);
+
 #if __cplusplus
 } // extern "C"
 #endif
@@ -44,6 +44,18 @@ int vibrator_on(int timeout_ms);
  */
 int vibrator_off();
 
+/**
+ * Play a vibration pattern in the background, replacing any pattern being played.
+ * vibrator_on() and vibrator_off() stop the pattern.
+ *
+ * @param on_off_ms durations in milliseconds, alternating on and off, starting with on
+ * @param n number of durations
+ * @param repeat index at which to restart once the end is reached, -1 to play once
+ *
+ * @return 0 if successful, -1 if error
+ */
+int vibrator_play_pattern(const int *on_off_ms, int n, int repeat);
+
 #if __cplusplus
 }  // extern "C"
 #endif
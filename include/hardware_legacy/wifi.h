@@ -17,6 +17,8 @@
 #ifndef _WIFI_H
 #define _WIFI_H
 
+#include <stddef.h>
+
 #if __cplusplus
 extern "C" {
 #endif
@@ -71,6 +73,17 @@ int wifi_connect_to_supplicant();
  */
 void wifi_close_supplicant_connection();
 
+/**
+ * wifi_open_supplicant_connection() opens the connection of
+ * wifi_connect_to_supplicant() on the control socket at path, without
+ * checking that the supplicant service is running. wifi_close_sockets()
+ * closes it without waiting for the service to stop.
+ *
+ * @return 0 on success, < 0 on failure.
+ */
+int wifi_open_supplicant_connection(const char *path);
+void wifi_close_sockets();
+
 /**
  * wifi_wait_for_event() performs a blocking call to 
  * get a Wi-Fi event and returns a string representing 
@@ -85,6 +98,24 @@ void wifi_close_supplicant_connection();
  */
 int wifi_wait_for_event(char *buf, size_t len);
 
+/**
+ * wifi_wait_for_events() blocks like wifi_wait_for_event() until an event
+ * is received, then also returns the events already queued behind it,
+ * without blocking again.
+ *
+ * Events are formatted as by wifi_wait_for_event() and stored back to back,
+ * each NUL terminated, in buf. Queued events are only taken while a
+ * maximum size event still fits, 4 KiB.
+ *
+ * @param buf is the buffer the events are stored in
+ * @param len is the size of buf
+ * @param offsets receives the offset of each event in buf
+ * @param max_events is the number of entries of offsets
+ *
+ * @return the number of events, < 0 on error.
+ */
+int wifi_wait_for_events(char *buf, size_t len, size_t *offsets, int max_events);
+
 /**
  * wifi_command() issues a command to the Wi-Fi driver.
  *
@@ -106,6 +137,191 @@ int wifi_wait_for_event(char *buf, size_t len);
  */
 int wifi_command(const char *command, char *reply, size_t *reply_len);
 
+/**
+ * Completion callback of wifi_command_async(), called on a command pool thread.
+ *
+ * @param cookie is the cookie passed to wifi_command_async()
+ * @param request_id is the id returned by wifi_command_async()
+ * @param result is 0 if successful, -1 on error and -2 on timeout
+ * @param reply is the NUL terminated reply, only valid during the call
+ * @param reply_len is the length of the reply
+ */
+typedef void (*wifi_command_callback)(void *cookie, int request_id, int result,
+                                      const char *reply, size_t reply_len);
+
+/**
+ * wifi_command_async() queues a command for the supplicant connected by
+ * wifi_connect_to_supplicant() and returns without waiting for the reply.
+ *
+ * Commands are sent on a pool of control connections separate from the one
+ * used by wifi_command(), so a slow command does not delay the others. A
+ * timed out or failed command only resets its own connection. The callback is
+ * called once for each accepted command, also when the connection is closed
+ * before the command is sent: closing the connection returns once the pool
+ * threads have failed those commands. It must not call
+ * wifi_close_supplicant_connection(). Commands are refused while the
+ * connection is being closed.
+ *
+ * @param command is the string command
+ * @param timeout_ms is the reply timeout, 0 for the default of 10 seconds
+ * @param callback is called with the reply
+ * @param cookie is passed to callback
+ *
+ * @return a positive request id, < 0 if the command could not be queued.
+ */
+int wifi_command_async(const char *command, int timeout_ms,
+                       wifi_command_callback callback, void *cookie);
+
+/**
+ * Supplicant event ids, one for each CTRL-EVENT-* event. Other events are
+ * WIFI_EVENT_OTHER and are told apart by their name.
+ */
+enum {
+    WIFI_EVENT_OTHER = 0,
+    WIFI_EVENT_CONNECTED,
+    WIFI_EVENT_DISCONNECTED,
+    WIFI_EVENT_ASSOC_REJECT,
+    WIFI_EVENT_AUTH_REJECT,
+    WIFI_EVENT_TERMINATING,
+    WIFI_EVENT_PASSWORD_CHANGED,
+    WIFI_EVENT_EAP_NOTIFICATION,
+    WIFI_EVENT_EAP_STARTED,
+    WIFI_EVENT_EAP_PROPOSED_METHOD,
+    WIFI_EVENT_EAP_METHOD,
+    WIFI_EVENT_EAP_PEER_CERT,
+    WIFI_EVENT_EAP_TLS_CERT_ERROR,
+    WIFI_EVENT_EAP_STATUS,
+    WIFI_EVENT_EAP_SUCCESS,
+    WIFI_EVENT_EAP_FAILURE,
+    WIFI_EVENT_SSID_TEMP_DISABLED,
+    WIFI_EVENT_SSID_REENABLED,
+    WIFI_EVENT_SCAN_STARTED,
+    WIFI_EVENT_SCAN_RESULTS,
+    WIFI_EVENT_STATE_CHANGE,
+    WIFI_EVENT_BSS_ADDED,
+    WIFI_EVENT_BSS_REMOVED,
+    WIFI_EVENT_LINK_SPEED,
+    WIFI_EVENT_DRIVER_STATE,
+    WIFI_EVENT_REGDOM_CHANGE,
+    WIFI_EVENT_MAX
+};
+
+#define WIFI_EVENT_MAX_PARAMS	16
+
+/**
+ * A key=value parameter of an event, pointing into the event buffer. Quotes
+ * around the value are not included.
+ */
+struct wifi_event_param {
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+};
+
+/**
+ * A parsed supplicant event. All strings point into the buffer passed to
+ * wifi_parse_event() and are not NUL terminated.
+ */
+struct wifi_event {
+    const char *iface;          /* IFNAME= value, NULL if absent */
+    size_t iface_len;
+    int level;                  /* message level, -1 if absent */
+    int id;                     /* WIFI_EVENT_* */
+    const char *name;           /* event name, e.g. "CTRL-EVENT-CONNECTED" */
+    size_t name_len;
+    const char *text;           /* everything after the name */
+    size_t text_len;
+    int num_params;             /* params beyond WIFI_EVENT_MAX_PARAMS are dropped */
+    struct wifi_event_param params[WIFI_EVENT_MAX_PARAMS];
+};
+
+/**
+ * wifi_parse_event() splits a raw event, as received from the supplicant
+ * with its IFNAME= and <N> prefixes, without copying or modifying it.
+ *
+ * @param buf is the event
+ * @param len is the length of the event
+ * @param event receives the parsed event
+ *
+ * @return 0 if successful, < 0 if the event is empty.
+ */
+int wifi_parse_event(const char *buf, size_t len, struct wifi_event *event);
+
+/**
+ * wifi_wait_for_parsed_event() is like wifi_wait_for_event() but leaves the
+ * event as received and parses it with wifi_parse_event().
+ *
+ * @param buf is the buffer the event is received into
+ * @param len is the size of buf
+ * @param event receives the parsed event, pointing into buf
+ *
+ * @return the length of the event, < 0 on error.
+ */
+int wifi_wait_for_parsed_event(char *buf, size_t len, struct wifi_event *event);
+
+/**
+ * Event callback of an interface connected with wifi_connect_interface(),
+ * called from wifi_dispatch_events().
+ *
+ * @param cookie is the cookie passed to wifi_connect_interface()
+ * @param iface is the interface the connection was opened for
+ * @param event is the parsed event, only valid during the call. When the
+ *        connection is lost, a WIFI_EVENT_TERMINATING event is delivered.
+ */
+typedef void (*wifi_event_callback)(void *cookie, const char *iface,
+                                    const struct wifi_event *event);
+
+#define WIFI_MAX_INTERFACES	8
+
+/**
+ * wifi_connect_interface() opens a control and a monitor connection to the
+ * supplicant control interface of iface, independently of
+ * wifi_connect_to_supplicant() and of the other interfaces.
+ *
+ * @param iface is the interface name, e.g. "wlan0" or "p2p0"
+ * @param callback receives the events of the interface
+ * @param cookie is passed to callback
+ *
+ * @return 0 if successful, < 0 if error or if WIFI_MAX_INTERFACES are
+ *         already connected.
+ */
+int wifi_connect_interface(const char *iface, wifi_event_callback callback, void *cookie);
+
+/**
+ * wifi_connect_interface_on_path() is wifi_connect_interface() on the
+ * control socket at path instead of the one of the running supplicant.
+ */
+int wifi_connect_interface_on_path(const char *iface, const char *path,
+                                   wifi_event_callback callback, void *cookie);
+
+/**
+ * wifi_close_interface() closes the connections opened by
+ * wifi_connect_interface(). It may be called from the event callback.
+ */
+void wifi_close_interface(const char *iface);
+
+/**
+ * wifi_interface_command() is wifi_command() on the control connection of
+ * iface. Commands on different interfaces do not wait for each other. The
+ * connection is reopened after a timeout, a late reply is then dropped.
+ *
+ * @return 0 if successful, -2 on timeout, < 0 if an error.
+ */
+int wifi_interface_command(const char *iface, const char *command,
+                           char *reply, size_t *reply_len);
+
+/**
+ * wifi_dispatch_events() waits at most timeout_ms for events on the monitor
+ * connections of all connected interfaces and delivers them to their
+ * callbacks, on the calling thread.
+ *
+ * @param timeout_ms is the maximum time to wait, -1 to wait forever
+ *
+ * @return the number of events delivered, < 0 if an error.
+ */
+int wifi_dispatch_events(int timeout_ms);
+
 /**
  * do_dhcp_request() issues a dhcp request and returns the acquired
  * information. 
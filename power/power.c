@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <limits.h>
 
 #define LOG_TAG "power"
 #include <utils/Log.h>
@@ -46,10 +47,90 @@ const char * const NEW_PATHS[] = {
     "/sys/power/wake_unlock",
 };
 
-//XXX static pthread_once_t g_initialized = THREAD_ONCE_INIT;
-static int g_initialized = 0;
+static pthread_once_t g_initialized = PTHREAD_ONCE_INIT;
 static int g_fds[OUR_FD_COUNT];
 static int g_error = 1;
+// "id timeout_ns" is only understood by /sys/power/wake_lock
+static int g_kernel_timeouts = 0;
+
+/*
+ * In-process wake lock table. Each id is only written to sysfs when its count of holders
+ * in this process goes from 0 to 1 or from 1 to 0. Counts move between non zero values
+ * without locking; the transitions to and from 0 and the matching sysfs writes happen
+ * under g_lock so that they reach the kernel in order.
+ * Entries are never freed, which lets lookups walk the buckets without locking.
+ */
+#define WAKE_LOCK_BUCKETS 64
+
+struct wake_lock_entry {
+    struct wake_lock_entry *next;
+    int holders;
+    /* accounting updated without g_lock */
+    uint32_t acquire_count;
+    int max_holders;
+    int last_tid;
+    /* protected by g_lock */
+    int64_t acquired_at;
+    int64_t total_held_ns;
+    int64_t max_held_ns;
+    /* async mode state, see set_wake_lock_async() */
+    struct wake_lock_entry *queue_next;
+    int queued;
+    /* last state written to sysfs, kept in both modes */
+    int kernel_held;
+    int64_t released_at;
+    /* timed hold, see acquire_wake_lock_timeout() */
+    struct wake_lock_entry *timer_next;
+    struct wake_lock_entry **timer_pprev;
+    int64_t expires;
+    int timed;
+    /* set while the kernel lock was taken with a timeout, read without g_lock */
+    int kernel_timeout;
+    char id[];
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+// times a caller found g_lock taken
+static uint32_t g_lock_contended = 0;
+static struct wake_lock_entry *g_buckets[WAKE_LOCK_BUCKETS];
+
+/*
+ * Async mode: transitions are queued for a writer thread instead of being written by the
+ * caller. Releases are delayed by ASYNC_RELEASE_DELAY_NS so that a release followed by an
+ * acquire of the same id, or the reverse, cancel out without touching sysfs.
+ */
+#define ASYNC_RELEASE_DELAY_NS 10000000LL
+#define ASYNC_BATCH 32
+
+/* protected by g_lock */
+static int g_async = 0;
+static int g_async_running = 0;
+static struct wake_lock_entry *g_queue = NULL;
+static pthread_cond_t g_queue_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t g_async_control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_async_writer;
+
+/*
+ * Timed holds expire through a hierarchical timer wheel with 1 ms ticks: level n has
+ * WHEEL_SLOTS slots of WHEEL_SLOTS^n ticks each, and timers move down a level when their
+ * slot comes up. Insertion and cancellation are O(1). The wheel thread only wakes up when
+ * a slot holding timers is due, not on every tick.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_TICK_NS 1000000LL
+#define WHEEL_RANGE (1LL << (WHEEL_BITS * WHEEL_LEVELS))
+
+/* protected by g_lock */
+static struct wake_lock_entry *g_wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static struct wake_lock_entry *g_expired = NULL;
+static int64_t g_wheel_now = 0;
+static int g_timers = 0;
+static int g_wheel_started = 0;
+static pthread_t g_wheel_thread;
+static pthread_cond_t g_wheel_cond = PTHREAD_COND_INITIALIZER;
 
 static int64_t systemTime()
 {
@@ -77,17 +158,308 @@ open_file_descriptors(const char * const paths[])
     return 0;
 }
 
+static void
+open_fds_once(void)
+{
+    if(open_file_descriptors(NEW_PATHS) < 0)
+        open_file_descriptors(OLD_PATHS);
+    else
+        g_kernel_timeouts = 1;
+}
+
 static inline void
 initialize_fds(void)
 {
-    // XXX: should be this:
-    //pthread_once(&g_initialized, open_file_descriptors);
-    // XXX: not this:
-    if (g_initialized == 0) {
-        if(open_file_descriptors(NEW_PATHS) < 0)
-            open_file_descriptors(OLD_PATHS);
-        g_initialized = 1;
+    pthread_once(&g_initialized, open_fds_once);
+}
+
+/* FNV-1a */
+static uint32_t
+hash_id(const char* id)
+{
+    uint32_t hash = 2166136261u;
+    while (*id) {
+        hash ^= (unsigned char)*id++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct wake_lock_entry *
+find_entry(const char* id, uint32_t hash)
+{
+    struct wake_lock_entry *e;
+    e = __atomic_load_n(&g_buckets[hash % WAKE_LOCK_BUCKETS], __ATOMIC_ACQUIRE);
+    for (; e != NULL; e = e->next) {
+        if (!strcmp(e->id, id))
+            return e;
+    }
+    return NULL;
+}
+
+/* must be called with g_lock held */
+static struct wake_lock_entry *
+find_or_add_entry(const char* id, uint32_t hash)
+{
+    struct wake_lock_entry *e = find_entry(id, hash);
+    if (e != NULL)
+        return e;
+
+    size_t len = strlen(id);
+    e = calloc(1, sizeof(struct wake_lock_entry) + len + 1);
+    if (e == NULL)
+        return NULL;
+    memcpy(e->id, id, len + 1);
+    e->next = g_buckets[hash % WAKE_LOCK_BUCKETS];
+    __atomic_store_n(&g_buckets[hash % WAKE_LOCK_BUCKETS], e, __ATOMIC_RELEASE);
+    return e;
+}
+
+/* adds delta to holders unless that would make it cross 0, returns 1 on success */
+static int
+update_holders_if_held(struct wake_lock_entry *e, int delta)
+{
+    int holders = __atomic_load_n(&e->holders, __ATOMIC_RELAXED);
+    while (holders > 0 && holders + delta > 0) {
+        if (__atomic_compare_exchange_n(&e->holders, &holders, holders + delta, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+static void
+lock_table(void)
+{
+    if (pthread_mutex_trylock(&g_lock) != 0) {
+        __atomic_fetch_add(&g_lock_contended, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&g_lock);
+    }
+}
+
+/* accounts an acquire of e made by the calling thread */
+static void
+note_acquire(struct wake_lock_entry *e)
+{
+    int holders = __atomic_load_n(&e->holders, __ATOMIC_RELAXED);
+    int max = __atomic_load_n(&e->max_holders, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&e->acquire_count, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->last_tid, gettid(), __ATOMIC_RELAXED);
+    while (holders > max) {
+        if (__atomic_compare_exchange_n(&e->max_holders, &max, holders, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+}
+
+/* must be called with g_lock held */
+static void
+queue_transition(struct wake_lock_entry *e)
+{
+    if (__atomic_load_n(&e->holders, __ATOMIC_RELAXED) == 0) {
+        e->released_at = systemTime();
+    }
+    if (!e->queued) {
+        e->queued = 1;
+        e->queue_next = g_queue;
+        g_queue = e;
+    }
+    pthread_cond_signal(&g_queue_cond);
+}
+
+/*
+ * Moves the entries whose kernel state must be written now out of the queue, and returns
+ * how many were stored in writes. Entries whose transition was cancelled are dropped, and
+ * releases still in their delay stay queued; *next_deadline is set to the earliest one.
+ * With flush set, releases are not delayed. Must be called with g_lock held.
+ */
+static int
+dequeue_transitions(struct wake_lock_entry **writes, int *held, int flush,
+                    int64_t *next_deadline)
+{
+    struct wake_lock_entry **prev = &g_queue;
+    struct wake_lock_entry *e;
+    int64_t now = systemTime();
+    int count = 0;
+
+    *next_deadline = 0;
+    while ((e = *prev) != NULL && count < ASYNC_BATCH) {
+        int h = __atomic_load_n(&e->holders, __ATOMIC_RELAXED) > 0;
+        if (!h && h != e->kernel_held && !flush) {
+            int64_t deadline = e->released_at + ASYNC_RELEASE_DELAY_NS;
+            if (now < deadline) {
+                if (*next_deadline == 0 || deadline < *next_deadline)
+                    *next_deadline = deadline;
+                prev = &e->queue_next;
+                continue;
+            }
+        }
+        *prev = e->queue_next;
+        e->queued = 0;
+        if (h != e->kernel_held) {
+            e->kernel_held = h;
+            writes[count] = e;
+            held[count++] = h;
+        }
+    }
+    return count;
+}
+
+static void
+write_transitions(struct wake_lock_entry **writes, int *held, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        int fd = g_fds[held[i] ? ACQUIRE_PARTIAL_WAKE_LOCK : RELEASE_WAKE_LOCK];
+        if (write(fd, writes[i]->id, strlen(writes[i]->id)) < 0) {
+            ALOGE("could not %s wake lock %s: %s", held[i] ? "acquire" : "release",
+                  writes[i]->id, strerror(errno));
+        }
+    }
+}
+
+/* waits on cond with g_lock held until the CLOCK_MONOTONIC time deadline */
+static void
+wait_until(pthread_cond_t *cond, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t when;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    when = ts.tv_sec * 1000000000LL + ts.tv_nsec + (deadline - systemTime());
+    ts.tv_sec = when / 1000000000LL;
+    ts.tv_nsec = when % 1000000000LL;
+    pthread_cond_timedwait(cond, &g_lock, &ts);
+}
+
+static void *
+async_writer_loop(void *arg)
+{
+    struct wake_lock_entry *writes[ASYNC_BATCH];
+    int held[ASYNC_BATCH];
+
+    pthread_mutex_lock(&g_lock);
+    while (1) {
+        int64_t next_deadline;
+        int count = dequeue_transitions(writes, held, !g_async_running, &next_deadline);
+
+        if (count > 0) {
+            // transitions are decided under the lock but written without it, this thread
+            // being the only writer keeps them in order
+            pthread_mutex_unlock(&g_lock);
+            write_transitions(writes, held, count);
+            pthread_mutex_lock(&g_lock);
+            continue;
+        }
+        if (g_queue == NULL && !g_async_running)
+            break;
+        if (next_deadline == 0) {
+            pthread_cond_wait(&g_queue_cond, &g_lock);
+        } else {
+            wait_until(&g_queue_cond, next_deadline);
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+int
+set_wake_lock_async(int enable)
+{
+    initialize_fds();
+
+    if (g_error) return g_error;
+
+    pthread_mutex_lock(&g_async_control_lock);
+    pthread_mutex_lock(&g_lock);
+    if (enable && !g_async) {
+        g_async = 1;
+        g_async_running = 1;
+        int err = pthread_create(&g_async_writer, NULL, async_writer_loop, NULL);
+        if (err != 0) {
+            g_async = 0;
+            g_async_running = 0;
+            pthread_mutex_unlock(&g_lock);
+            pthread_mutex_unlock(&g_async_control_lock);
+            return err;
+        }
+    } else if (!enable && g_async) {
+        // the writer flushes everything queued before exiting
+        g_async_running = 0;
+        pthread_cond_signal(&g_queue_cond);
+        pthread_mutex_unlock(&g_lock);
+        pthread_join(g_async_writer, NULL);
+        pthread_mutex_lock(&g_lock);
+
+        // transitions queued after the writer exited
+        struct wake_lock_entry *writes[ASYNC_BATCH];
+        int held[ASYNC_BATCH];
+        int64_t next_deadline;
+        int count;
+        while ((count = dequeue_transitions(writes, held, 1, &next_deadline)) > 0) {
+            write_transitions(writes, held, count);
+        }
+        g_async = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    pthread_mutex_unlock(&g_async_control_lock);
+    return 0;
+}
+
+/*
+ * Writes id to wake_lock, with a kernel timeout if timeout_ns is not 0 and the kernel
+ * supports it. Must be called with g_lock held.
+ */
+static int
+write_acquire(struct wake_lock_entry *e, int64_t timeout_ns)
+{
+    if (timeout_ns > 0 && g_kernel_timeouts) {
+        char buf[PATH_MAX];
+        int len = snprintf(buf, sizeof(buf), "%s %lld", e->id, (long long)timeout_ns);
+        if (len > 0 && len < (int)sizeof(buf)) {
+            int ret = write(g_fds[ACQUIRE_PARTIAL_WAKE_LOCK], buf, len);
+            if (ret >= 0) {
+                __atomic_store_n(&e->kernel_timeout, 1, __ATOMIC_RELEASE);
+            }
+            return ret;
+        }
+    }
+    __atomic_store_n(&e->kernel_timeout, 0, __ATOMIC_RELEASE);
+    return write(g_fds[ACQUIRE_PARTIAL_WAKE_LOCK], e->id, strlen(e->id));
+}
+
+/*
+ * Adds a holder to e, taking the kernel lock if it is the first one. timeout_ns is the
+ * kernel timeout to use in that case, 0 for none. Must be called with g_lock held.
+ */
+static int
+add_holder_locked(struct wake_lock_entry *e, int64_t timeout_ns)
+{
+    int ret = strlen(e->id);
+
+    if (update_holders_if_held(e, 1)) {
+        note_acquire(e);
+        // an untimed holder must not be dropped by the kernel timeout of a timed one
+        if (timeout_ns == 0 && __atomic_load_n(&e->kernel_timeout, __ATOMIC_ACQUIRE)) {
+            ret = write_acquire(e, 0);
+        }
+        return ret;
+    }
+    if (!g_async) {
+        ret = write_acquire(e, timeout_ns);
+        if (ret >= 0) {
+            e->kernel_held = 1;
+        }
+    }
+    if (ret >= 0) {
+        e->acquired_at = systemTime();
+        __atomic_store_n(&e->holders, 1, __ATOMIC_RELEASE);
+        note_acquire(e);
+        if (g_async) {
+            queue_transition(e);
+        }
     }
+    return ret;
 }
 
 int
@@ -99,16 +471,275 @@ acquire_wake_lock(int lock, const char* id)
 
     if (g_error) return g_error;
 
-    int fd;
+    if (lock != PARTIAL_WAKE_LOCK) {
+        return EINVAL;
+    }
+
+    uint32_t hash = hash_id(id);
+    struct wake_lock_entry *e = find_entry(id, hash);
+    if (e != NULL && update_holders_if_held(e, 1)) {
+        note_acquire(e);
+        if (!__atomic_load_n(&e->kernel_timeout, __ATOMIC_ACQUIRE)) {
+            return strlen(id);
+        }
+        // held with a kernel timeout: rewrite it without
+        int ret = strlen(id);
+        lock_table();
+        if (__atomic_load_n(&e->kernel_timeout, __ATOMIC_ACQUIRE)) {
+            ret = write_acquire(e, 0);
+        }
+        pthread_mutex_unlock(&g_lock);
+        return ret;
+    }
+
+    lock_table();
+    e = find_or_add_entry(id, hash);
+    if (e == NULL) {
+        pthread_mutex_unlock(&g_lock);
+        return write(g_fds[ACQUIRE_PARTIAL_WAKE_LOCK], id, strlen(id));
+    }
+    int ret = add_holder_locked(e, 0);
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+/* must be called with g_lock held */
+static void
+wheel_link(struct wake_lock_entry **head, struct wake_lock_entry *e)
+{
+    e->timer_next = *head;
+    if (*head != NULL) {
+        (*head)->timer_pprev = &e->timer_next;
+    }
+    *head = e;
+    e->timer_pprev = head;
+}
+
+/* must be called with g_lock held */
+static void
+wheel_unlink(struct wake_lock_entry *e)
+{
+    *e->timer_pprev = e->timer_next;
+    if (e->timer_next != NULL) {
+        e->timer_next->timer_pprev = e->timer_pprev;
+    }
+    e->timer_next = NULL;
+    e->timer_pprev = NULL;
+}
+
+/* must be called with g_lock held */
+static void
+wheel_insert(struct wake_lock_entry *e)
+{
+    int64_t expires = e->expires;
+    int64_t delta;
+    int level = 0;
+
+    if (expires < g_wheel_now) {
+        expires = g_wheel_now;
+    }
+    delta = expires - g_wheel_now;
+    if (delta >= WHEEL_RANGE) {
+        // parked in the last level, reinserted when its slot comes up
+        expires = g_wheel_now + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+    while (level < WHEEL_LEVELS - 1 && delta >= (1LL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    wheel_link(&g_wheel[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)], e);
+}
 
-    if (lock == PARTIAL_WAKE_LOCK) {
-        fd = g_fds[ACQUIRE_PARTIAL_WAKE_LOCK];
+/* Returns the next tick at which a slot holding timers is due, -1 if there is none. */
+static int64_t
+wheel_next_event()
+{
+    int64_t next = -1;
+    int level, slot;
+
+    for (slot = 1; slot < WHEEL_SLOTS; slot++) {
+        if (g_wheel[0][(g_wheel_now + slot) & (WHEEL_SLOTS - 1)] != NULL) {
+            next = g_wheel_now + slot;
+            break;
+        }
+    }
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        int64_t base = (g_wheel_now >> shift) + 1;
+        for (slot = 0; slot < WHEEL_SLOTS; slot++) {
+            if (g_wheel[level][slot] != NULL) {
+                int64_t when = (base + ((slot - base) & (WHEEL_SLOTS - 1))) << shift;
+                if (next < 0 || when < next) {
+                    next = when;
+                }
+            }
+        }
+    }
+    return next;
+}
+
+/* Advances the wheel to tick, which must be its next event, and moves due timers to
+ * g_expired. Must be called with g_lock held. */
+static void
+wheel_advance(int64_t tick)
+{
+    struct wake_lock_entry *e;
+    int level;
+
+    g_wheel_now = tick;
+    // cascade from the top so that timers moved down are cascaded again if needed
+    for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+        int shift = WHEEL_BITS * level;
+        if ((tick & ((1LL << shift) - 1)) != 0) {
+            continue;
+        }
+        struct wake_lock_entry **slot = &g_wheel[level][(tick >> shift) & (WHEEL_SLOTS - 1)];
+        while ((e = *slot) != NULL) {
+            wheel_unlink(e);
+            wheel_insert(e);
+        }
+    }
+    struct wake_lock_entry **slot = &g_wheel[0][tick & (WHEEL_SLOTS - 1)];
+    while ((e = *slot) != NULL) {
+        wheel_unlink(e);
+        wheel_link(&g_expired, e);
+    }
+}
+
+/*
+ * Drops a holder of e, e may be NULL, and releases the kernel lock of id with the last
+ * one. A pending timed hold is cancelled then. Must be called with g_lock held.
+ */
+static int
+release_holder_locked(struct wake_lock_entry *e, const char *id)
+{
+    ssize_t len;
+    while (e != NULL) {
+        if (update_holders_if_held(e, -1)) {
+            return 1;
+        }
+        // a concurrent acquire may still move holders from 1 to 2, retry if it does
+        int holders = 1;
+        if (__atomic_compare_exchange_n(&e->holders, &holders, 0, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            int64_t held = systemTime() - e->acquired_at;
+            e->total_held_ns += held;
+            if (held > e->max_held_ns) {
+                e->max_held_ns = held;
+            }
+            __atomic_store_n(&e->kernel_timeout, 0, __ATOMIC_RELEASE);
+            if (e->timed) {
+                // the timer must not drop a holder of a later acquire
+                wheel_unlink(e);
+                e->timed = 0;
+                g_timers--;
+            }
+            if (g_async) {
+                queue_transition(e);
+                return 1;
+            }
+            break;
+        }
+        if (holders == 0) {
+            break;
+        }
+    }
+    // also written when not held by this process: it may have been acquired by another one
+    len = write(g_fds[RELEASE_WAKE_LOCK], id, strlen(id));
+    if (e != NULL && len >= 0) {
+        // async mode must not skip the next acquire as already written
+        e->kernel_held = 0;
+    }
+    return len >= 0;
+}
+
+static void *
+wheel_loop(void *arg)
+{
+    struct wake_lock_entry *e;
+
+    pthread_mutex_lock(&g_lock);
+    while (1) {
+        if ((e = g_expired) != NULL) {
+            wheel_unlink(e);
+            e->timed = 0;
+            g_timers--;
+            // released under the lock so that no release and acquire can come in between
+            release_holder_locked(e, e->id);
+            continue;
+        }
+        if (g_timers == 0) {
+            pthread_cond_wait(&g_wheel_cond, &g_lock);
+            continue;
+        }
+        int64_t next = wheel_next_event();
+        if (next <= systemTime() / WHEEL_TICK_NS) {
+            wheel_advance(next);
+        } else {
+            wait_until(&g_wheel_cond, next * WHEEL_TICK_NS);
+        }
     }
-    else {
+    return NULL;
+}
+
+int
+acquire_wake_lock_timeout(const char* id, long timeout_ms)
+{
+    initialize_fds();
+
+    if (g_error) return g_error;
+
+    if (timeout_ms < 0) {
         return EINVAL;
     }
 
-    return write(fd, id, strlen(id));
+    lock_table();
+    struct wake_lock_entry *e = find_or_add_entry(id, hash_id(id));
+    if (e == NULL) {
+        pthread_mutex_unlock(&g_lock);
+        return ENOMEM;
+    }
+    if (!g_wheel_started) {
+        int err = pthread_create(&g_wheel_thread, NULL, wheel_loop, NULL);
+        if (err != 0) {
+            pthread_mutex_unlock(&g_lock);
+            return err;
+        }
+        g_wheel_started = 1;
+    }
+
+    int64_t now = systemTime() / WHEEL_TICK_NS;
+    if (g_timers == 0) {
+        g_wheel_now = now;
+    }
+    int64_t expires = now + timeout_ms;
+    if (expires <= g_wheel_now) {
+        expires = g_wheel_now + 1;
+    }
+    int64_t timeout_ns = (int64_t)timeout_ms * 1000000LL;
+
+    int ret = strlen(id);
+    if (e->timed) {
+        // already held with a timeout: only move the deadline
+        wheel_unlink(e);
+        note_acquire(e);
+        if (__atomic_load_n(&e->kernel_timeout, __ATOMIC_ACQUIRE)) {
+            ret = write_acquire(e, timeout_ns);
+        }
+    } else {
+        ret = add_holder_locked(e, timeout_ns);
+        if (ret < 0) {
+            pthread_mutex_unlock(&g_lock);
+            return ret;
+        }
+        e->timed = 1;
+        g_timers++;
+    }
+    e->expires = expires;
+    wheel_insert(e);
+    pthread_cond_signal(&g_wheel_cond);
+    pthread_mutex_unlock(&g_lock);
+    return ret;
 }
 
 int
@@ -120,6 +751,114 @@ release_wake_lock(const char* id)
 
     if (g_error) return g_error;
 
-    ssize_t len = write(g_fds[RELEASE_WAKE_LOCK], id, strlen(id));
-    return len >= 0;
+    struct wake_lock_entry *e = find_entry(id, hash_id(id));
+    if (e != NULL && update_holders_if_held(e, -1)) {
+        return 1;
+    }
+
+    lock_table();
+    int ret = release_holder_locked(e, id);
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+/* must be called with g_lock held */
+static void
+get_stats_locked(struct wake_lock_entry *e, int64_t now, struct wake_lock_stats* stats)
+{
+    stats->holders = __atomic_load_n(&e->holders, __ATOMIC_ACQUIRE);
+    stats->acquire_count = __atomic_load_n(&e->acquire_count, __ATOMIC_RELAXED);
+    stats->max_holders = __atomic_load_n(&e->max_holders, __ATOMIC_RELAXED);
+    stats->last_tid = __atomic_load_n(&e->last_tid, __ATOMIC_RELAXED);
+    stats->total_held_ns = e->total_held_ns;
+    stats->max_held_ns = e->max_held_ns;
+    if (stats->holders > 0) {
+        int64_t held = now - e->acquired_at;
+        stats->total_held_ns += held;
+        if (held > stats->max_held_ns) {
+            stats->max_held_ns = held;
+        }
+    }
+}
+
+int
+get_wake_lock_stats(const char* id, struct wake_lock_stats* stats)
+{
+    struct wake_lock_entry *e = find_entry(id, hash_id(id));
+    if (e == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    get_stats_locked(e, systemTime(), stats);
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+static int
+write_fully(int fd, const void* data, size_t len)
+{
+    const char* p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+int
+dump_wake_locks(int fd, int format)
+{
+    char buf[PATH_MAX + 160];
+    int64_t now = systemTime();
+    int i, err = 0;
+
+    if (format != WAKE_LOCK_DUMP_TEXT && format != WAKE_LOCK_DUMP_BINARY) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    if (format == WAKE_LOCK_DUMP_TEXT) {
+        int len = snprintf(buf, sizeof(buf),
+                "Wake locks (lock contended %u times):\n"
+                " %-32s %8s %8s %12s %12s %8s %8s\n",
+                __atomic_load_n(&g_lock_contended, __ATOMIC_RELAXED),
+                "Id", "Holders", "Max", "Acquires", "Held ms", "Max ms", "Tid");
+        err = write_fully(fd, buf, len);
+    }
+    for (i = 0; i < WAKE_LOCK_BUCKETS && err == 0; i++) {
+        struct wake_lock_entry *e;
+        for (e = g_buckets[i]; e != NULL && err == 0; e = e->next) {
+            struct wake_lock_stats stats;
+            get_stats_locked(e, now, &stats);
+            if (format == WAKE_LOCK_DUMP_TEXT) {
+                int len = snprintf(buf, sizeof(buf), " %-32s %8d %8d %12u %12lld %8lld %8d\n",
+                        e->id, stats.holders, stats.max_holders, stats.acquire_count,
+                        (long long)(stats.total_held_ns / 1000000),
+                        (long long)(stats.max_held_ns / 1000000), stats.last_tid);
+                if (len >= (int)sizeof(buf)) {
+                    len = sizeof(buf) - 1;
+                }
+                err = write_fully(fd, buf, len);
+            } else {
+                uint32_t id_len = strlen(e->id);
+                err = write_fully(fd, &stats, sizeof(stats));
+                if (err == 0) {
+                    err = write_fully(fd, &id_len, sizeof(id_len));
+                }
+                if (err == 0) {
+                    err = write_fully(fd, e->id, id_len);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return err == 0 ? 0 : errno;
 }
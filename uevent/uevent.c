@@ -16,33 +16,115 @@
 
 #include <hardware_legacy/uevent.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <poll.h>
 #include <pthread.h>
+#include <time.h>
 
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/queue.h>
+#include <linux/filter.h>
 #include <linux/netlink.h>
 
+#define LOG_TAG "uevent"
+#include <utils/Log.h>
 
-LIST_HEAD(uevent_handler_head, uevent_handler) uevent_handler_list;
-pthread_mutex_t uevent_handler_list_lock = PTHREAD_MUTEX_INITIALIZER;
+/* largest filter string accepted by uevent_add_filtered_native_handler() */
+#define UEVENT_FILTER_LEN 32
+
+/* socket receive buffer sizes, see uevent_set_high_throughput() */
+#define UEVENT_RCVBUF (64*1024)
+#define UEVENT_HIGH_THROUGHPUT_RCVBUF (1024*1024)
+
+/* messages received by the dispatcher with a single recvmmsg() call */
+#define UEVENT_BATCH_SIZE 16
+
+/* polling period of a removal waiting for the dispatches in progress */
+#define UEVENT_REMOVE_WAIT_US 100
+
+/* message offsets searched for the SUBSYSTEM key by the socket filter */
+#define UEVENT_FILTER_SCAN_LEN 768
+
+#define UEVENT_FILTER_ACCEPT 0xffffffff
+#define UEVENT_FILTER_DROP 0
+
+/* big endian word as loaded by BPF_LD|BPF_W */
+#define FILTER_WORD(a, b, c, d) \
+    (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
 
 struct uevent_handler {
+    /* exactly one of handler and event_handler is set */
     void (*handler)(void *data, const char *msg, int msg_len);
+    void (*event_handler)(void *data, const struct uevent_event *event);
     void *handler_data;
-    LIST_ENTRY(uevent_handler) list;
+    /* subscription filters, empty strings match any value */
+    char subsystem[UEVENT_FILTER_LEN];
+    char action[UEVENT_FILTER_LEN];
+};
+
+/*
+ * Handlers are kept in an immutable array replaced on each registration change, so that
+ * dispatch never takes a lock and registration changes never block dispatch. Adding a
+ * handler never waits for handlers to return.
+ *
+ * Replaced arrays are reclaimed with epochs: a dispatch counts itself in readers[] for
+ * the epoch it started in, and the epoch only advances when no dispatch from the epoch
+ * before is still running. An array retired in epoch E may still be used by dispatches
+ * from E or earlier, all of which are done once the epoch reaches E + 2. A removal waits
+ * for that before returning, so that the removed handler is not running anymore.
+ */
+struct handler_array {
+    struct handler_array *next_retired;
+    int retire_epoch;
+    int count;
+    struct uevent_handler handlers[];
 };
 
+/* serializes registration changes and reclamation */
+static pthread_mutex_t handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct handler_array *handlers = NULL;
+static struct handler_array *retired_handlers = NULL;
+static int epoch = 0;
+static int readers[2] = { 0, 0 };
+
+/* set while the thread runs dispatch(), removals from a handler cannot wait for it */
+static pthread_once_t dispatch_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dispatch_key;
+
 static int fd = -1;
 
+/* peer of fd when events come from uevent_inject() instead of the kernel */
+static int injector_fd = -1;
+
+/* trace file written by dispatch(), see uevent_start_recording() */
+static pthread_mutex_t recording_lock = PTHREAD_MUTEX_INITIALIZER;
+static int recording_fd = -1;
+
+/* dispatcher thread state, see uevent_start_dispatcher() */
+static pthread_t dispatcher_thread;
+static int dispatcher_running = 0;
+static int dispatcher_wake_fds[2] = { -1, -1 };
+
+/* preallocated recvmmsg() message pool, only used by the dispatcher thread */
+static struct mmsghdr dispatcher_msgs[UEVENT_BATCH_SIZE];
+static struct iovec dispatcher_iovs[UEVENT_BATCH_SIZE];
+static char dispatcher_buffers[UEVENT_BATCH_SIZE][UEVENT_MSG_LEN + 2];
+
+/* socket filter state, protected by handlers_lock */
+static int high_throughput = 0;
+static struct sock_filter filter_insns[BPF_MAXINSNS];
+
 /* Returns 0 on failure, 1 on success */
 int uevent_init()
 {
     struct sockaddr_nl addr;
-    int sz = 64*1024;
+    int sz = UEVENT_RCVBUF;
     int s;
 
     memset(&addr, 0, sizeof(addr));
@@ -65,72 +147,829 @@ int uevent_init()
     return (fd > 0);
 }
 
+/* Returns 0 on failure, 1 on success */
+int uevent_init_injector()
+{
+    int sv[2];
+    int sz = UEVENT_RCVBUF;
+
+    if (fd >= 0)
+        return 0;
+
+    /* datagrams keep message boundaries like netlink, and senders block when it is full */
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+        return 0;
+
+    setsockopt(sv[0], SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz));
+
+    fd = sv[0];
+    injector_fd = sv[1];
+    return 1;
+}
+
+int uevent_inject(const char *msg, int msg_len)
+{
+    if (injector_fd < 0 || msg_len > UEVENT_MSG_LEN)
+        return -1;
+    if (TEMP_FAILURE_RETRY(send(injector_fd, msg, msg_len, 0)) != msg_len)
+        return -1;
+    return 0;
+}
+
 int uevent_get_fd()
 {
     return fd;
 }
 
+static int64_t monotonic_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int write_fully(int out, const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0) {
+        ssize_t written = TEMP_FAILURE_RETRY(write(out, p, len));
+        if (written <= 0)
+            return -1;
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static int read_fully(int in, void *data, size_t len)
+{
+    char *p = data;
+
+    while (len > 0) {
+        ssize_t count = TEMP_FAILURE_RETRY(read(in, p, len));
+        if (count <= 0)
+            return (count == 0 && p == (char *)data) ? 0 : -1;
+        p += count;
+        len -= count;
+    }
+    return 1;
+}
+
+int uevent_start_recording(const char *path)
+{
+    struct uevent_trace_header header;
+    int out;
+
+    out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        ALOGE("could not open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    header.magic = UEVENT_TRACE_MAGIC;
+    header.version = UEVENT_TRACE_VERSION;
+    if (write_fully(out, &header, sizeof(header)) < 0) {
+        close(out);
+        return -1;
+    }
+
+    pthread_mutex_lock(&recording_lock);
+    if (recording_fd >= 0)
+        close(recording_fd);
+    __atomic_store_n(&recording_fd, out, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&recording_lock);
+    return 0;
+}
+
+void uevent_stop_recording()
+{
+    pthread_mutex_lock(&recording_lock);
+    if (recording_fd >= 0) {
+        close(recording_fd);
+        __atomic_store_n(&recording_fd, -1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&recording_lock);
+}
+
+static void record_event(const char *msg, int msg_len)
+{
+    struct uevent_trace_record record;
+
+    record.timestamp_ns = monotonic_ns();
+    record.msg_len = msg_len;
+    record.reserved = 0;
+
+    pthread_mutex_lock(&recording_lock);
+    if (recording_fd >= 0 &&
+            (write_fully(recording_fd, &record, sizeof(record)) < 0 ||
+             write_fully(recording_fd, msg, msg_len) < 0)) {
+        ALOGE("could not record uevent, recording stopped: %s", strerror(errno));
+        close(recording_fd);
+        __atomic_store_n(&recording_fd, -1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&recording_lock);
+}
+
+int uevent_open_trace(const char *path)
+{
+    struct uevent_trace_header header;
+    int in;
+
+    in = open(path, O_RDONLY);
+    if (in < 0)
+        return -1;
+    if (read_fully(in, &header, sizeof(header)) != 1 ||
+            header.magic != UEVENT_TRACE_MAGIC || header.version != UEVENT_TRACE_VERSION) {
+        ALOGE("%s is not a uevent trace", path);
+        close(in);
+        return -1;
+    }
+    return in;
+}
+
+int uevent_read_trace(int trace_fd, struct uevent_trace_record *record,
+                      char *msg, int msg_len)
+{
+    int err = read_fully(trace_fd, record, sizeof(*record));
+
+    if (err <= 0)
+        return err;
+    if (record->msg_len > (uint32_t)msg_len)
+        return -1;
+    if (read_fully(trace_fd, msg, record->msg_len) != 1)
+        return -1;
+    return 1;
+}
+
+int uevent_replay_trace(const char *path, int realtime)
+{
+    struct uevent_trace_record record;
+    char msg[UEVENT_MSG_LEN];
+    int64_t first = 0, start = 0;
+    int trace_fd, count = 0, err;
+
+    if (injector_fd < 0)
+        return -1;
+    trace_fd = uevent_open_trace(path);
+    if (trace_fd < 0)
+        return -1;
+
+    while ((err = uevent_read_trace(trace_fd, &record, msg, sizeof(msg))) > 0) {
+        if (realtime) {
+            int64_t when;
+            struct timespec ts;
+
+            if (count == 0) {
+                first = record.timestamp_ns;
+                start = monotonic_ns();
+            }
+            when = start + (record.timestamp_ns - first);
+            ts.tv_sec = when / 1000000000LL;
+            ts.tv_nsec = when % 1000000000LL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+        }
+        if (uevent_inject(msg, record.msg_len) < 0) {
+            err = -1;
+            break;
+        }
+        count++;
+    }
+    close(trace_fd);
+
+    if (err < 0) {
+        ALOGE("replay of %s failed after %d events", path, count);
+        return -1;
+    }
+    return count;
+}
+
+/* FNV-1a */
+static unsigned int hash_key(const char *key, size_t len)
+{
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * A uevent is a "action@devpath" header followed by NUL terminated KEY=value strings.
+ * Fields are stored in message order and chained per hash bucket in reverse order, so
+ * that lookups return the first occurrence of a key like a linear scan would.
+ */
+static void parse_event(const char *msg, int msg_len, struct uevent_event *event)
+{
+    const char *end = msg + msg_len;
+    const char *s = msg;
+    int i;
+
+    event->msg = msg;
+    event->msg_len = msg_len;
+    event->action = NULL;
+    event->subsystem = NULL;
+    event->devpath = NULL;
+    event->num_fields = 0;
+    memset(event->buckets, UEVENT_NO_FIELD, sizeof(event->buckets));
+
+    /* skip the header */
+    s += strnlen(s, end - s) + 1;
+
+    while (s < end && event->num_fields < UEVENT_MAX_FIELDS) {
+        struct uevent_field *field = &event->fields[event->num_fields];
+        size_t len = strnlen(s, end - s);
+        const char *equal;
+
+        if (s + len == end) {
+            /* not NUL terminated: truncated message */
+            break;
+        }
+        equal = memchr(s, '=', len);
+        if (equal != NULL) {
+            field->key = s;
+            field->key_len = equal - s;
+            field->value = equal + 1;
+            field->value_len = len - field->key_len - 1;
+            field->hash = hash_key(s, field->key_len);
+            event->num_fields++;
+        }
+        s += len + 1;
+    }
+    if (s < end && event->num_fields == UEVENT_MAX_FIELDS)
+        ALOGW("more than %d fields in uevent, ignoring the others", UEVENT_MAX_FIELDS);
+
+    for (i = event->num_fields - 1; i >= 0; i--) {
+        struct uevent_field *field = &event->fields[i];
+        unsigned char *bucket = &event->buckets[field->hash % UEVENT_HASH_BUCKETS];
+
+        field->next = *bucket;
+        *bucket = i;
+    }
+
+    event->action = uevent_event_get(event, "ACTION");
+    event->subsystem = uevent_event_get(event, "SUBSYSTEM");
+    event->devpath = uevent_event_get(event, "DEVPATH");
+}
+
+const char *uevent_event_get(const struct uevent_event *event, const char *key)
+{
+    size_t len = strlen(key);
+    unsigned int hash = hash_key(key, len);
+    unsigned char i = event->buckets[hash % UEVENT_HASH_BUCKETS];
+
+    while (i != UEVENT_NO_FIELD) {
+        const struct uevent_field *field = &event->fields[i];
+        if (field->hash == hash && field->key_len == len && !memcmp(field->key, key, len))
+            return field->value;
+        i = field->next;
+    }
+    return NULL;
+}
+
+static int filter_matches(const char *filter, const char *value)
+{
+    if (filter[0] == '\0')
+        return 1;
+    return value != NULL && !strcmp(filter, value);
+}
+
+/*
+ * Advances the epoch as far as running dispatches allow and frees the arrays no dispatch
+ * can use anymore. Must be called with handlers_lock held.
+ */
+static void reclaim_handlers()
+{
+    struct handler_array **prev = &retired_handlers;
+    struct handler_array *array;
+    int current = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+    int step;
+
+    for (step = 0; step < 2; step++) {
+        if (__atomic_load_n(&readers[(current - 1) & 1], __ATOMIC_SEQ_CST) != 0)
+            break;
+        current++;
+        __atomic_store_n(&epoch, current, __ATOMIC_SEQ_CST);
+    }
+
+    while ((array = *prev) != NULL) {
+        if (current - array->retire_epoch >= 2) {
+            *prev = array->next_retired;
+            free(array);
+        } else {
+            prev = &array->next_retired;
+        }
+    }
+}
+
+static void create_dispatch_key()
+{
+    pthread_key_create(&dispatch_key, NULL);
+}
+
+static void dispatch(const char *msg, int msg_len)
+{
+    struct uevent_event event;
+    struct handler_array *array;
+    void *in_dispatch;
+    int reader_epoch;
+    int i;
+
+    pthread_once(&dispatch_key_once, create_dispatch_key);
+    in_dispatch = pthread_getspecific(dispatch_key);
+    pthread_setspecific(dispatch_key, (void *)1);
+
+    if (__atomic_load_n(&recording_fd, __ATOMIC_RELAXED) >= 0)
+        record_event(msg, msg_len);
+
+    parse_event(msg, msg_len, &event);
+
+    reader_epoch = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&readers[reader_epoch & 1], 1, __ATOMIC_SEQ_CST);
+    array = __atomic_load_n(&handlers, __ATOMIC_SEQ_CST);
+
+    for (i = 0; array != NULL && i < array->count; i++) {
+        const struct uevent_handler *h = &array->handlers[i];
+
+        if (!filter_matches(h->subsystem, event.subsystem) ||
+                !filter_matches(h->action, event.action))
+            continue;
+        if (h->event_handler != NULL)
+            h->event_handler(h->handler_data, &event);
+        else
+            h->handler(h->handler_data, msg, msg_len);
+    }
+
+    __atomic_fetch_sub(&readers[reader_epoch & 1], 1, __ATOMIC_SEQ_CST);
+    pthread_setspecific(dispatch_key, in_dispatch);
+
+    /* never wait here: a registration in progress reclaims on its own */
+    if (__atomic_load_n(&retired_handlers, __ATOMIC_RELAXED) != NULL &&
+            pthread_mutex_trylock(&handlers_lock) == 0) {
+        reclaim_handlers();
+        pthread_mutex_unlock(&handlers_lock);
+    }
+}
+
 int uevent_next_event(char* buffer, int buffer_length)
 {
     while (1) {
         struct pollfd fds;
         int nr;
-    
+
         fds.fd = fd;
         fds.events = POLLIN;
         fds.revents = 0;
         nr = poll(&fds, 1, -1);
-     
+
         if(nr > 0 && (fds.revents & POLLIN)) {
             int count = recv(fd, buffer, buffer_length, 0);
             if (count > 0) {
-                struct uevent_handler *h;
-                pthread_mutex_lock(&uevent_handler_list_lock);
-                LIST_FOREACH(h, &uevent_handler_list, list)
-                    h->handler(h->handler_data, buffer, buffer_length);
-                pthread_mutex_unlock(&uevent_handler_list_lock);
-
+                dispatch(buffer, count);
                 return count;
-            } 
+            }
         }
     }
-    
+
     // won't get here
     return 0;
 }
 
+struct filter_prog {
+    struct sock_filter *insns;
+    int len;
+    int overflow;
+};
+
+static int emit(struct filter_prog *prog, uint16_t code, uint32_t k, uint8_t jt, uint8_t jf)
+{
+    int index = prog->len;
+
+    if (prog->len >= BPF_MAXINSNS) {
+        prog->overflow = 1;
+        return index;
+    }
+    prog->insns[prog->len].code = code;
+    prog->insns[prog->len].jt = jt;
+    prog->insns[prog->len].jf = jf;
+    prog->insns[prog->len].k = k;
+    prog->len++;
+    return index;
+}
+
+static int compare_length(const void *a, const void *b)
+{
+    size_t la = strlen(*(const char * const *)a);
+    size_t lb = strlen(*(const char * const *)b);
+
+    return (la > lb) - (la < lb);
+}
+
+/*
+ * Compares the value at X + offset with subsystem, NUL included, and accepts the message
+ * on a match. On a mismatch execution continues after the emitted block.
+ */
+static void emit_subsystem_match(struct filter_prog *prog, uint32_t offset,
+                                 const char *subsystem)
+{
+    int len = strlen(subsystem) + 1;
+    int chunks = 0;
+    int pos, chunk;
+
+    for (pos = 0; pos < len; chunks++)
+        pos += (len - pos >= 4) ? 4 : (len - pos >= 2) ? 2 : 1;
+
+    for (pos = 0, chunk = 0; pos < len; chunk++) {
+        const unsigned char *c = (const unsigned char *)subsystem + pos;
+        /* instructions left in this block after the jump */
+        uint8_t skip = 2 * (chunks - chunk - 1) + 1;
+
+        if (len - pos >= 4) {
+            emit(prog, BPF_LD | BPF_W | BPF_IND, offset + pos, 0, 0);
+            emit(prog, BPF_JMP | BPF_JEQ | BPF_K,
+                 FILTER_WORD(c[0], c[1], c[2], c[3]), 0, skip);
+            pos += 4;
+        } else if (len - pos >= 2) {
+            emit(prog, BPF_LD | BPF_H | BPF_IND, offset + pos, 0, 0);
+            emit(prog, BPF_JMP | BPF_JEQ | BPF_K,
+                 ((uint32_t)c[0] << 8) | c[1], 0, skip);
+            pos += 2;
+        } else {
+            emit(prog, BPF_LD | BPF_B | BPF_IND, offset + pos, 0, 0);
+            emit(prog, BPF_JMP | BPF_JEQ | BPF_K, c[0], 0, skip);
+            pos += 1;
+        }
+    }
+    emit(prog, BPF_RET | BPF_K, UEVENT_FILTER_ACCEPT, 0, 0);
+}
+
+/*
+ * Builds a filter accepting only the events whose SUBSYSTEM is subscribed by a handler.
+ * Returns the number of instructions, 0 when every event must be received.
+ *
+ * Classic BPF has no loops and the SUBSYSTEM key has no fixed offset, so the filter is an
+ * unrolled search of the first UEVENT_FILTER_SCAN_LEN bytes. Every kernel uevent has a
+ * SUBSYSTEM key which is found before the search runs past the end of the message.
+ * Messages longer than the scanned range where it is not found, and messages where the
+ * match is not the key itself, are accepted and left to the handler filters. A message
+ * without a SUBSYSTEM key that ends inside the scanned range is dropped: the search loads
+ * past its end, which makes the filter return 0. This includes injected events without
+ * SUBSYSTEM, which only reach handlers while no filter is attached. Bounding every load
+ * by the message length would take two more instructions per scanned byte, which does
+ * not fit in BPF_MAXINSNS.
+ */
+static int build_filter(struct sock_filter *insns)
+{
+    struct filter_prog prog;
+    const struct uevent_handler *h;
+    const char **subsystems;
+    int count = 0;
+    int matcher, k, i, j;
+
+    if (handlers == NULL || handlers->count == 0)
+        return 0;
+    for (j = 0; j < handlers->count; j++) {
+        if (handlers->handlers[j].subsystem[0] == '\0')
+            return 0;
+    }
+
+    subsystems = malloc(handlers->count * sizeof(*subsystems));
+    if (subsystems == NULL)
+        return 0;
+    for (j = 0; j < handlers->count; j++) {
+        h = &handlers->handlers[j];
+        for (i = 0; i < count; i++) {
+            if (!strcmp(subsystems[i], h->subsystem))
+                break;
+        }
+        if (i == count)
+            subsystems[count++] = h->subsystem;
+    }
+    /*
+     * A load past the end of the message drops it: match shorter names first so that a
+     * longer name never hides a shorter one matching a value at the end of the message.
+     */
+    qsort(subsystems, count, sizeof(*subsystems), compare_length);
+
+    prog.insns = insns;
+    prog.len = 0;
+    prog.overflow = 0;
+
+    /* drop udev daemon messages */
+    emit(&prog, BPF_LD | BPF_W | BPF_ABS, 0, 0, 0);
+    emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, FILTER_WORD('l', 'i', 'b', 'u'), 0, 1);
+    emit(&prog, BPF_RET | BPF_K, UEVENT_FILTER_DROP, 0, 0);
+
+    /* search "SUBS", X = its offset */
+    matcher = prog.len + 4 * UEVENT_FILTER_SCAN_LEN + 1;
+    for (k = 0; k < UEVENT_FILTER_SCAN_LEN; k++) {
+        emit(&prog, BPF_LD | BPF_W | BPF_ABS, k, 0, 0);
+        emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, FILTER_WORD('S', 'U', 'B', 'S'), 0, 2);
+        emit(&prog, BPF_LDX | BPF_W | BPF_IMM, k, 0, 0);
+        emit(&prog, BPF_JMP | BPF_JA, matcher - (prog.len + 1), 0, 0);
+    }
+    emit(&prog, BPF_RET | BPF_K, UEVENT_FILTER_ACCEPT, 0, 0);
+
+    /* check the rest of "SUBSYSTEM=" then the value */
+    emit(&prog, BPF_LD | BPF_W | BPF_IND, 4, 0, 0);
+    emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, FILTER_WORD('Y', 'S', 'T', 'E'), 1, 0);
+    emit(&prog, BPF_RET | BPF_K, UEVENT_FILTER_ACCEPT, 0, 0);
+    emit(&prog, BPF_LD | BPF_H | BPF_IND, 8, 0, 0);
+    emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, ('M' << 8) | '=', 1, 0);
+    emit(&prog, BPF_RET | BPF_K, UEVENT_FILTER_ACCEPT, 0, 0);
+    for (i = 0; i < count; i++)
+        emit_subsystem_match(&prog, 10, subsystems[i]);
+    emit(&prog, BPF_RET | BPF_K, UEVENT_FILTER_DROP, 0, 0);
+
+    free(subsystems);
+
+    if (prog.overflow) {
+        ALOGW("too many subsystems subscribed, socket filter disabled");
+        return 0;
+    }
+    return prog.len;
+}
+
+/* Must be called with handlers_lock held. */
+static void update_socket_filter()
+{
+    struct sock_fprog fprog;
+    int unused = 0;
+
+    if (fd < 0)
+        return;
+
+    if (high_throughput) {
+        fprog.len = build_filter(filter_insns);
+        fprog.filter = filter_insns;
+        if (fprog.len > 0) {
+            if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+                ALOGW("could not attach socket filter: %s", strerror(errno));
+            return;
+        }
+    }
+    /* fails with ENOENT when no filter is attached */
+    setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused));
+}
+
+/*
+ * Publishes a copy of the handler array with added inserted first and removed left out,
+ * and retires the previous array. Must be called with handlers_lock held.
+ */
+static int replace_handlers(const struct uevent_handler *added,
+                            const struct uevent_handler *removed)
+{
+    struct handler_array *old = handlers;
+    struct handler_array *array;
+    int old_count = (old != NULL) ? old->count : 0;
+    int count = old_count + (added != NULL ? 1 : 0) - (removed != NULL ? 1 : 0);
+    int i;
+
+    array = malloc(sizeof(struct handler_array) + count * sizeof(struct uevent_handler));
+    if (array == NULL)
+        return -1;
+    array->next_retired = NULL;
+    array->retire_epoch = 0;
+    array->count = 0;
+    if (added != NULL)
+        array->handlers[array->count++] = *added;
+    for (i = 0; i < old_count; i++) {
+        if (&old->handlers[i] != removed)
+            array->handlers[array->count++] = old->handlers[i];
+    }
+
+    __atomic_store_n(&handlers, array, __ATOMIC_SEQ_CST);
+    if (old != NULL) {
+        old->retire_epoch = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+        old->next_retired = retired_handlers;
+        retired_handlers = old;
+    }
+    update_socket_filter();
+    reclaim_handlers();
+    return 0;
+}
+
+static int add_handler(const char *subsystem, const char *action,
+                       void (*handler)(void *data, const char *msg, int msg_len),
+                       void (*event_handler)(void *data, const struct uevent_event *event),
+                       void *handler_data)
+{
+    struct uevent_handler h;
+    int err;
+
+    if ((subsystem != NULL && strlen(subsystem) >= UEVENT_FILTER_LEN) ||
+            (action != NULL && strlen(action) >= UEVENT_FILTER_LEN))
+        return -1;
+
+    memset(&h, 0, sizeof(h));
+    h.handler = handler;
+    h.event_handler = event_handler;
+    h.handler_data = handler_data;
+    if (subsystem != NULL)
+        strcpy(h.subsystem, subsystem);
+    if (action != NULL)
+        strcpy(h.action, action);
+
+    pthread_mutex_lock(&handlers_lock);
+    err = replace_handlers(&h, NULL);
+    pthread_mutex_unlock(&handlers_lock);
+
+    return err;
+}
+
 int uevent_add_native_handler(void (*handler)(void *data, const char *msg, int msg_len),
                              void *handler_data)
 {
-    struct uevent_handler *h;
+    return add_handler(NULL, NULL, handler, NULL, handler_data);
+}
 
-    h = malloc(sizeof(struct uevent_handler));
-    if (h == NULL)
-        return -1;
-    h->handler = handler;
-    h->handler_data = handler_data;
+int uevent_add_filtered_native_handler(const char *subsystem, const char *action,
+                                       void (*handler)(void *data, const char *msg, int msg_len),
+                                       void *handler_data)
+{
+    return add_handler(subsystem, action, handler, NULL, handler_data);
+}
+
+int uevent_add_event_handler(const char *subsystem, const char *action,
+                             void (*handler)(void *data, const struct uevent_event *event),
+                             void *handler_data)
+{
+    return add_handler(subsystem, action, NULL, handler, handler_data);
+}
 
-    pthread_mutex_lock(&uevent_handler_list_lock);
-    LIST_INSERT_HEAD(&uevent_handler_list, h, list);
-    pthread_mutex_unlock(&uevent_handler_list_lock);
+static int remove_handler(void (*handler)(void *data, const char *msg, int msg_len),
+                          void (*event_handler)(void *data, const struct uevent_event *event))
+{
+    int err = -1;
+    int retire_epoch = 0;
+    int done;
+    int i;
 
-    return 0;
+    pthread_mutex_lock(&handlers_lock);
+    for (i = 0; handlers != NULL && i < handlers->count; i++) {
+        const struct uevent_handler *h = &handlers->handlers[i];
+        if (h->handler == handler && h->event_handler == event_handler) {
+            /* the epoch replace_handlers() retires the current array in */
+            retire_epoch = epoch;
+            err = replace_handlers(NULL, h);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&handlers_lock);
+
+    if (err < 0)
+        return err;
+
+    /*
+     * Wait for the dispatches that may still call the handler. A handler removing one
+     * would wait for its own dispatch: the removal then only takes effect for the next
+     * events.
+     */
+    pthread_once(&dispatch_key_once, create_dispatch_key);
+    if (pthread_getspecific(dispatch_key) != NULL)
+        return 0;
+    while (1) {
+        pthread_mutex_lock(&handlers_lock);
+        reclaim_handlers();
+        done = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST) - retire_epoch >= 2;
+        pthread_mutex_unlock(&handlers_lock);
+        if (done)
+            return 0;
+        usleep(UEVENT_REMOVE_WAIT_US);
+    }
 }
 
 int uevent_remove_native_handler(void (*handler)(void *data, const char *msg, int msg_len))
 {
-    struct uevent_handler *h;
-    int err = -1;
+    return remove_handler(handler, NULL);
+}
+
+int uevent_remove_event_handler(void (*handler)(void *data, const struct uevent_event *event))
+{
+    return remove_handler(NULL, handler);
+}
 
-    pthread_mutex_lock(&uevent_handler_list_lock);
-    LIST_FOREACH(h, &uevent_handler_list, list) {
-        if (h->handler == handler) {
-            LIST_REMOVE(h, list);
-            err = 0;
+static void *dispatcher_loop(void *arg)
+{
+    int epoll_fd = (int)(intptr_t)arg;
+
+    while (1) {
+        struct epoll_event events[2];
+        int nr, i;
+
+        nr = epoll_wait(epoll_fd, events, 2, -1);
+        if (nr < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("epoll_wait failed: %s", strerror(errno));
             break;
-       }
+        }
+        for (i = 0; i < nr; i++) {
+            if (events[i].data.fd == dispatcher_wake_fds[0])
+                goto exit;
+        }
+        /* drain all pending events before waiting again */
+        while (1) {
+            nr = recvmmsg(fd, dispatcher_msgs, UEVENT_BATCH_SIZE, MSG_DONTWAIT, NULL);
+            if (nr <= 0) {
+                if (nr < 0 && errno != EAGAIN && errno != EINTR)
+                    ALOGW("recvmmsg failed: %s", strerror(errno));
+                break;
+            }
+            for (i = 0; i < nr; i++)
+                dispatch(dispatcher_buffers[i], dispatcher_msgs[i].msg_len);
+            /* a partial batch means the socket is empty */
+            if (nr < UEVENT_BATCH_SIZE)
+                break;
+        }
     }
-    pthread_mutex_unlock(&uevent_handler_list_lock);
 
-    return err;
+exit:
+    close(epoll_fd);
+    return NULL;
+}
+
+int uevent_start_dispatcher()
+{
+    struct epoll_event ev;
+    int epoll_fd;
+    int i;
+
+    if (dispatcher_running)
+        return 0;
+    if (fd < 0 && !uevent_init())
+        return -1;
+
+    memset(dispatcher_msgs, 0, sizeof(dispatcher_msgs));
+    for (i = 0; i < UEVENT_BATCH_SIZE; i++) {
+        dispatcher_iovs[i].iov_base = dispatcher_buffers[i];
+        dispatcher_iovs[i].iov_len = UEVENT_MSG_LEN;
+        dispatcher_msgs[i].msg_hdr.msg_iov = &dispatcher_iovs[i];
+        dispatcher_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (pipe(dispatcher_wake_fds) < 0)
+        return -1;
+    epoll_fd = epoll_create(2);
+    if (epoll_fd < 0)
+        goto err_epoll;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        goto err_ctl;
+    ev.data.fd = dispatcher_wake_fds[0];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dispatcher_wake_fds[0], &ev) < 0)
+        goto err_ctl;
+
+    if (pthread_create(&dispatcher_thread, NULL, dispatcher_loop,
+                       (void *)(intptr_t)epoll_fd) != 0)
+        goto err_ctl;
+
+    dispatcher_running = 1;
+    return 0;
+
+err_ctl:
+    close(epoll_fd);
+err_epoll:
+    close(dispatcher_wake_fds[0]);
+    close(dispatcher_wake_fds[1]);
+    dispatcher_wake_fds[0] = dispatcher_wake_fds[1] = -1;
+    return -1;
+}
+
+void uevent_stop_dispatcher()
+{
+    if (!dispatcher_running)
+        return;
+
+    TEMP_FAILURE_RETRY(write(dispatcher_wake_fds[1], "x", 1));
+    pthread_join(dispatcher_thread, NULL);
+    close(dispatcher_wake_fds[0]);
+    close(dispatcher_wake_fds[1]);
+    dispatcher_wake_fds[0] = dispatcher_wake_fds[1] = -1;
+    dispatcher_running = 0;
+}
+
+int uevent_set_high_throughput(int enable)
+{
+    int sz = enable ? UEVENT_HIGH_THROUGHPUT_RCVBUF : UEVENT_RCVBUF;
+
+    if (fd < 0 && !uevent_init())
+        return -1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz)) < 0)
+        ALOGW("could not set receive buffer size: %s", strerror(errno));
+
+    pthread_mutex_lock(&handlers_lock);
+    high_throughput = enable;
+    update_socket_filter();
+    pthread_mutex_unlock(&handlers_lock);
+
+    return 0;
 }
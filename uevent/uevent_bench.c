@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * uevent_bench: records live uevents to a trace file, or replays a trace through the
+ * uevent dispatcher and reports throughput and handler latency.
+ *
+ * With -s, stress tests handler registration instead: threads keep adding and removing
+ * handlers while injected events flood the dispatcher, and the run fails if a handler
+ * is called after its removal returned.
+ */
+
+#include <hardware_legacy/uevent.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_event {
+    char *msg;
+    int msg_len;
+    int64_t timestamp_ns;
+};
+
+static struct trace_event *events;
+static int num_events;
+/* injection time of each event, latency is measured from it */
+static int64_t *inject_ns;
+static int64_t *latency_ns;
+
+/* stress test, see stress() */
+#define STRESS_MAX_THREADS 8
+#define STRESS_DEFAULT_SECONDS 5
+
+/*
+ * One registration of a stress handler. Each thread alternates between two so that a
+ * call made for the previous registration is told apart from the current one.
+ */
+struct stress_registration {
+    int removed;
+    uint64_t calls;
+    uint64_t late_calls;
+};
+
+struct stress_thread {
+    pthread_t thread;
+    int index;
+    void (*handler)(void *data, const struct uevent_event *event);
+    struct stress_registration registrations[2];
+    uint64_t cycles;
+};
+
+static int stress_stop;
+static uint64_t stress_dispatched;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int received;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-r] [-n handlers] trace\n"
+            "       %s -c trace [-d seconds]\n"
+            "       %s -s threads [-d seconds]\n"
+            "  -r          replay with the recorded spacing instead of as fast as possible\n"
+            "  -n handlers number of handlers parsing each event, default 8\n"
+            "  -c          record live uevents to trace\n"
+            "  -s threads  stress handler registration with up to %d threads\n"
+            "  -d seconds  recording duration, default until killed, or stress duration,\n"
+            "              default %d\n",
+            name, name, name, STRESS_MAX_THREADS, STRESS_DEFAULT_SECONDS);
+}
+
+/* typical handler work: look up the keys a switch or power supply handler would use */
+static void parse_handler(void *data, const struct uevent_event *event)
+{
+    volatile const char *value;
+
+    value = uevent_event_get(event, "SWITCH_NAME");
+    value = uevent_event_get(event, "SWITCH_STATE");
+    value = uevent_event_get(event, "POWER_SUPPLY_CAPACITY");
+    (void)value;
+}
+
+/* registered first so that it runs after the other handlers */
+static void latency_handler(void *data, const struct uevent_event *event)
+{
+    int64_t now = now_ns();
+
+    pthread_mutex_lock(&done_lock);
+    if (received < num_events)
+        latency_ns[received] = now - inject_ns[received];
+    if (++received == num_events)
+        pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&done_lock);
+}
+
+static void stress_handler_call(void *data)
+{
+    struct stress_registration *r = data;
+
+    if (__atomic_load_n(&r->removed, __ATOMIC_SEQ_CST))
+        __atomic_fetch_add(&r->late_calls, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&r->calls, 1, __ATOMIC_RELAXED);
+}
+
+/* handlers are removed by function, each thread needs its own */
+#define STRESS_HANDLER(n) \
+    static void stress_handler_##n(void *data, const struct uevent_event *event) \
+    { \
+        stress_handler_call(data); \
+    }
+STRESS_HANDLER(0)
+STRESS_HANDLER(1)
+STRESS_HANDLER(2)
+STRESS_HANDLER(3)
+STRESS_HANDLER(4)
+STRESS_HANDLER(5)
+STRESS_HANDLER(6)
+STRESS_HANDLER(7)
+
+static void (* const stress_handlers[STRESS_MAX_THREADS])(void *data,
+                                                          const struct uevent_event *event) = {
+    stress_handler_0, stress_handler_1, stress_handler_2, stress_handler_3,
+    stress_handler_4, stress_handler_5, stress_handler_6, stress_handler_7,
+};
+
+static void stress_count_handler(void *data, const struct uevent_event *event)
+{
+    __atomic_fetch_add(&stress_dispatched, 1, __ATOMIC_RELAXED);
+}
+
+static void *stress_thread_loop(void *arg)
+{
+    struct stress_thread *t = arg;
+    /* odd threads subscribe to the flooded subsystem only, even ones to everything */
+    const char *subsystem = (t->index & 1) ? "stress" : NULL;
+
+    while (!__atomic_load_n(&stress_stop, __ATOMIC_RELAXED)) {
+        struct stress_registration *r = &t->registrations[t->cycles & 1];
+
+        __atomic_store_n(&r->removed, 0, __ATOMIC_SEQ_CST);
+        if (uevent_add_event_handler(subsystem, NULL, t->handler, r) < 0) {
+            fprintf(stderr, "thread %d: could not add handler\n", t->index);
+            break;
+        }
+        sched_yield();
+        if (uevent_remove_event_handler(t->handler) < 0) {
+            fprintf(stderr, "thread %d: could not remove handler\n", t->index);
+            break;
+        }
+        /* from here on, any call for r is a call after removal */
+        __atomic_store_n(&r->removed, 1, __ATOMIC_SEQ_CST);
+        t->cycles++;
+    }
+    return NULL;
+}
+
+static int stress(int nr_threads, int seconds)
+{
+    struct stress_thread threads[STRESS_MAX_THREADS];
+    uint64_t injected = 0, cycles = 0, calls = 0, late_calls = 0;
+    int64_t start, end;
+    char msg[128];
+    int i, j, len;
+
+    if (!uevent_init_injector()) {
+        fprintf(stderr, "could not create injector: %s\n", strerror(errno));
+        return 1;
+    }
+    uevent_add_event_handler(NULL, NULL, stress_count_handler, NULL);
+    if (uevent_start_dispatcher() < 0) {
+        fprintf(stderr, "could not start dispatcher\n");
+        return 1;
+    }
+
+    memset(threads, 0, sizeof(threads));
+    for (i = 0; i < nr_threads; i++) {
+        threads[i].index = i;
+        threads[i].handler = stress_handlers[i];
+        if (pthread_create(&threads[i].thread, NULL, stress_thread_loop, &threads[i]) != 0) {
+            fprintf(stderr, "could not create thread %d\n", i);
+            return 1;
+        }
+    }
+
+    start = now_ns();
+    end = start + seconds * 1000000000LL;
+    while (now_ns() < end) {
+        len = snprintf(msg, sizeof(msg),
+                       "change@/devices/virtual/stress%c"
+                       "ACTION=change%cDEVPATH=/devices/virtual/stress%c"
+                       "SUBSYSTEM=stress%cSEQNUM=%llu",
+                       0, 0, 0, 0, (unsigned long long)injected);
+        if (uevent_inject(msg, len + 1) < 0) {
+            fprintf(stderr, "injection failed at event %llu\n", (unsigned long long)injected);
+            return 1;
+        }
+        injected++;
+    }
+
+    __atomic_store_n(&stress_stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < nr_threads; i++)
+        pthread_join(threads[i].thread, NULL);
+    end = now_ns();
+    uevent_stop_dispatcher();
+
+    for (i = 0; i < nr_threads; i++) {
+        cycles += threads[i].cycles;
+        for (j = 0; j < 2; j++) {
+            calls += threads[i].registrations[j].calls;
+            late_calls += threads[i].registrations[j].late_calls;
+        }
+    }
+    printf("threads:     %d\n", nr_threads);
+    printf("elapsed:     %.3f s\n", (end - start) / 1e9);
+    printf("events:      %llu injected, %llu dispatched\n",
+           (unsigned long long)injected,
+           (unsigned long long)__atomic_load_n(&stress_dispatched, __ATOMIC_RELAXED));
+    printf("handlers:    %llu added and removed, %llu calls\n",
+           (unsigned long long)cycles, (unsigned long long)calls);
+    printf("late calls:  %llu\n", (unsigned long long)late_calls);
+    if (late_calls != 0) {
+        fprintf(stderr, "FAILED: handlers called after their removal returned\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int load_trace(const char *path)
+{
+    struct uevent_trace_record record;
+    char msg[UEVENT_MSG_LEN];
+    int capacity = 0;
+    int trace_fd, err;
+
+    trace_fd = uevent_open_trace(path);
+    if (trace_fd < 0) {
+        fprintf(stderr, "could not open trace %s\n", path);
+        return -1;
+    }
+    while ((err = uevent_read_trace(trace_fd, &record, msg, sizeof(msg))) > 0) {
+        if (num_events == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            events = realloc(events, capacity * sizeof(*events));
+            if (events == NULL)
+                break;
+        }
+        events[num_events].msg = malloc(record.msg_len);
+        if (events == NULL || events[num_events].msg == NULL) {
+            err = -1;
+            break;
+        }
+        memcpy(events[num_events].msg, msg, record.msg_len);
+        events[num_events].msg_len = record.msg_len;
+        events[num_events].timestamp_ns = record.timestamp_ns;
+        num_events++;
+    }
+    close(trace_fd);
+    if (err < 0 || events == NULL) {
+        fprintf(stderr, "could not read trace %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    int64_t la = *(const int64_t *)a;
+    int64_t lb = *(const int64_t *)b;
+
+    return (la > lb) - (la < lb);
+}
+
+static int record(const char *path, int seconds)
+{
+    if (!uevent_init()) {
+        fprintf(stderr, "could not open uevent socket: %s\n", strerror(errno));
+        return 1;
+    }
+    if (uevent_start_recording(path) < 0 || uevent_start_dispatcher() < 0) {
+        fprintf(stderr, "could not start recording to %s\n", path);
+        return 1;
+    }
+    if (seconds > 0) {
+        sleep(seconds);
+    } else {
+        while (1)
+            pause();
+    }
+    uevent_stop_dispatcher();
+    uevent_stop_recording();
+    return 0;
+}
+
+static int replay(const char *path, int realtime, int nr_handlers)
+{
+    int64_t start, end;
+    int i;
+
+    if (load_trace(path) < 0)
+        return 1;
+    if (num_events == 0) {
+        fprintf(stderr, "trace %s is empty\n", path);
+        return 1;
+    }
+    inject_ns = calloc(num_events, sizeof(*inject_ns));
+    latency_ns = calloc(num_events, sizeof(*latency_ns));
+    if (inject_ns == NULL || latency_ns == NULL)
+        return 1;
+
+    if (!uevent_init_injector()) {
+        fprintf(stderr, "could not create injector: %s\n", strerror(errno));
+        return 1;
+    }
+    uevent_add_event_handler(NULL, NULL, latency_handler, NULL);
+    for (i = 0; i < nr_handlers; i++)
+        uevent_add_event_handler(NULL, NULL, parse_handler, NULL);
+    if (uevent_start_dispatcher() < 0) {
+        fprintf(stderr, "could not start dispatcher\n");
+        return 1;
+    }
+
+    start = now_ns();
+    for (i = 0; i < num_events; i++) {
+        if (realtime) {
+            int64_t when = start + events[i].timestamp_ns - events[0].timestamp_ns;
+            struct timespec ts;
+
+            ts.tv_sec = when / 1000000000LL;
+            ts.tv_nsec = when % 1000000000LL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+        }
+        inject_ns[i] = now_ns();
+        if (uevent_inject(events[i].msg, events[i].msg_len) < 0) {
+            fprintf(stderr, "injection failed at event %d\n", i);
+            return 1;
+        }
+    }
+
+    pthread_mutex_lock(&done_lock);
+    while (received < num_events)
+        pthread_cond_wait(&done_cond, &done_lock);
+    pthread_mutex_unlock(&done_lock);
+    end = now_ns();
+    uevent_stop_dispatcher();
+
+    qsort(latency_ns, num_events, sizeof(*latency_ns), compare_ns);
+    printf("events:      %d\n", num_events);
+    printf("handlers:    %d\n", nr_handlers + 1);
+    printf("elapsed:     %.3f ms\n", (end - start) / 1e6);
+    printf("throughput:  %.0f events/s\n", num_events * 1e9 / (end - start));
+    printf("latency us:  p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+           latency_ns[num_events * 50 / 100] / 1e3,
+           latency_ns[num_events * 90 / 100] / 1e3,
+           latency_ns[num_events * 99 / 100] / 1e3,
+           latency_ns[num_events - 1] / 1e3);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *record_path = NULL;
+    int realtime = 0;
+    int nr_handlers = 8;
+    int nr_stress_threads = 0;
+    int seconds = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rn:c:s:d:")) != -1) {
+        switch (opt) {
+        case 'r':
+            realtime = 1;
+            break;
+        case 'n':
+            nr_handlers = atoi(optarg);
+            break;
+        case 'c':
+            record_path = optarg;
+            break;
+        case 's':
+            nr_stress_threads = atoi(optarg);
+            if (nr_stress_threads < 1 || nr_stress_threads > STRESS_MAX_THREADS) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (record_path != NULL)
+        return record(record_path, seconds);
+    if (nr_stress_threads > 0)
+        return stress(nr_stress_threads, seconds > 0 ? seconds : STRESS_DEFAULT_SECONDS);
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    return replay(argv[optind], realtime, nr_handlers);
+}
@@ -17,12 +17,48 @@
 #include "qemu.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #define THE_DEVICE "/sys/class/timed_output/vibrator/enable"
 
+/* control fd, opened once and kept open, protected by g_lock */
+static int g_fd = -1;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Pattern playback state, protected by g_lock. The player thread is started on the
+ * first vibrator_play_pattern() call and waits on g_cond while no pattern plays. Each
+ * new request bumps g_generation, which stops the pattern being played.
+ */
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t g_player_once = PTHREAD_ONCE_INIT;
+static int g_player_started = 0;
+static int *g_pattern = NULL;
+static int g_pattern_len = 0;
+static int g_repeat = -1;
+static unsigned int g_generation = 0;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* must be called with g_lock held */
+static int get_fd()
+{
+    if (g_fd < 0)
+        g_fd = open(THE_DEVICE, O_RDWR);
+    return g_fd;
+}
+
 int vibrator_exists()
 {
     int fd;
@@ -33,13 +69,13 @@ int vibrator_exists()
     }
 #endif
 
-    fd = open(THE_DEVICE, O_RDWR);
-    if(fd < 0)
-        return 0;
-    close(fd);
-    return 1;
+    pthread_mutex_lock(&g_lock);
+    fd = get_fd();
+    pthread_mutex_unlock(&g_lock);
+    return fd >= 0;
 }
 
+/* must be called with g_lock held */
 static int sendit(int timeout_ms)
 {
     int nwr, ret, fd;
@@ -51,25 +87,149 @@ static int sendit(int timeout_ms)
     }
 #endif
 
-    fd = open(THE_DEVICE, O_RDWR);
+    fd = get_fd();
     if(fd < 0)
         return errno;
 
     nwr = sprintf(value, "%d\n", timeout_ms);
     ret = write(fd, value, nwr);
-
-    close(fd);
+    if (ret < 0 && errno != EINTR) {
+        /* the device may have gone away, reopen it on the next call */
+        close(g_fd);
+        g_fd = -1;
+    }
 
     return (ret == nwr) ? 0 : -1;
 }
 
+/* must be called with g_lock held */
+static void stop_pattern()
+{
+    free(g_pattern);
+    g_pattern = NULL;
+    g_pattern_len = 0;
+    g_generation++;
+    pthread_cond_signal(&g_cond);
+}
+
+/*
+ * Plays g_pattern: each "on" step writes its duration to the timed output device, which
+ * turns itself off, and each "off" step only waits. Steps are scheduled on absolute
+ * deadlines from the start of the pattern so that write latency does not accumulate.
+ */
+static void *player_loop(void *arg)
+{
+    pthread_mutex_lock(&g_lock);
+    while (1) {
+        unsigned int generation;
+        int64_t deadline;
+        int i;
+
+        while (g_pattern == NULL)
+            pthread_cond_wait(&g_cond, &g_lock);
+
+        generation = g_generation;
+        deadline = now_ns();
+        i = 0;
+        while (generation == g_generation) {
+            int duration_ms = g_pattern[i];
+
+            if ((i & 1) == 0 && duration_ms > 0)
+                sendit(duration_ms);
+            deadline += duration_ms * 1000000LL;
+
+            while (generation == g_generation) {
+                struct timespec ts;
+                int64_t when;
+                int64_t remaining = deadline - now_ns();
+                if (remaining <= 0)
+                    break;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                when = ts.tv_sec * 1000000000LL + ts.tv_nsec + remaining;
+                ts.tv_sec = when / 1000000000LL;
+                ts.tv_nsec = when % 1000000000LL;
+                pthread_cond_timedwait(&g_cond, &g_lock, &ts);
+            }
+            if (generation != g_generation)
+                break;
+
+            if (++i == g_pattern_len) {
+                if (g_repeat < 0) {
+                    stop_pattern();
+                    break;
+                }
+                i = g_repeat;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void start_player()
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    g_player_started = pthread_create(&thread, &attr, player_loop, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
 int vibrator_on(int timeout_ms)
 {
+    int ret;
+
     /* constant on, up to maximum allowed time */
-    return sendit(timeout_ms);
+    pthread_mutex_lock(&g_lock);
+    if (g_pattern != NULL)
+        stop_pattern();
+    ret = sendit(timeout_ms);
+    pthread_mutex_unlock(&g_lock);
+    return ret;
 }
 
 int vibrator_off()
 {
-    return sendit(0);
+    return vibrator_on(0);
+}
+
+int vibrator_play_pattern(const int *on_off_ms, int n, int repeat)
+{
+    int64_t total = 0;
+    int *pattern;
+    int i;
+
+    if (on_off_ms == NULL || n <= 0 || repeat >= n)
+        return -1;
+    for (i = 0; i < n; i++) {
+        if (on_off_ms[i] < 0)
+            return -1;
+        if (i >= repeat)
+            total += on_off_ms[i];
+    }
+    /* a repeating pattern of zero length would spin */
+    if (repeat >= 0 && total == 0)
+        return -1;
+
+    pthread_once(&g_player_once, start_player);
+    if (!g_player_started)
+        return -1;
+
+    pattern = malloc(n * sizeof(int));
+    if (pattern == NULL)
+        return -1;
+    memcpy(pattern, on_off_ms, n * sizeof(int));
+
+    pthread_mutex_lock(&g_lock);
+    if (g_pattern != NULL)
+        stop_pattern();
+    sendit(0);
+    g_pattern = pattern;
+    g_pattern_len = n;
+    g_repeat = repeat;
+    g_generation++;
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    return 0;
 }
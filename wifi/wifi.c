@@ -19,9 +19,14 @@
 #include <errno.h>
 #include <string.h>
 #include <dirent.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <poll.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "hardware_legacy/wifi.h"
 #ifdef LIBWPA_CLIENT_EXISTS
@@ -37,6 +42,7 @@
 #ifdef HAVE_LIBC_SYSTEM_PROPERTIES
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
+#include <linux/futex.h>
 #endif
 
 extern int do_dhcp();
@@ -71,6 +77,8 @@ static struct wpa_ctrl *monitor_conn;
 static int exit_sockets[2];
 
 static char primary_iface[PROPERTY_VALUE_MAX];
+/* control socket path of the last wifi_open_supplicant_connection() */
+static char ctrl_path[PATH_MAX];
 // TODO: use new ANDROID_SOCKET mechanism, once support for multiple
 // sockets is in
 
@@ -122,6 +130,8 @@ static const char IFNAME[]              = "IFNAME=";
 static const char WPA_EVENT_IGNORE[]    = "CTRL-EVENT-IGNORE ";
 
 static const char SUPP_ENTROPY_FILE[]   = WIFI_ENTROPY_FILE;
+/* largest event received by wifi_dispatch_events() */
+#define EVENT_BUF_SIZE			4096
 static unsigned char dummy_key[21] = { 0x02, 0x11, 0xbe, 0x33, 0x43, 0x35,
                                        0x68, 0x47, 0x84, 0x99, 0xa9, 0x2b,
                                        0x1c, 0xd3, 0xee, 0xff, 0xf1, 0xe2,
@@ -132,12 +142,124 @@ static char supplicant_name[PROPERTY_VALUE_MAX];
 /* Is either SUPP_PROP_NAME or P2P_PROP_NAME */
 static char supplicant_prop_name[PROPERTY_KEY_MAX];
 
+/*
+ * Supplicant config and entropy preparation, started by wifi_load_driver() so that it
+ * overlaps with the module and firmware load, and collected by wifi_start_supplicant().
+ */
+static pthread_mutex_t prepare_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t prepare_thread;
+static int prepare_started;
+static int prepare_result;
+static int64_t prepare_time_ms;
+
+static void start_prepare_supplicant();
+static void discard_prepare_supplicant();
+
+/* fallback polling period of wait_for_property() */
+#define PROPERTY_POLL_US		5000
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+#ifdef HAVE_LIBC_SYSTEM_PROPERTIES
+/*
+ * Blocks until the serial of pi changes from serial or timeout_ms elapse. init wakes
+ * futex waiters on the serial, which is the first field of prop_info; if it is not found
+ * there, fall back to polling.
+ */
+static void wait_for_serial_change(const prop_info *pi, unsigned serial, int64_t timeout_ms)
+{
+    const volatile unsigned *addr = (const volatile unsigned *)pi;
+
+    if (*addr == serial) {
+        struct timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        syscall(__NR_futex, addr, FUTEX_WAIT, serial, &ts, NULL, 0);
+    } else {
+        usleep(timeout_ms * 1000 < PROPERTY_POLL_US ? timeout_ms * 1000 : PROPERTY_POLL_US);
+    }
+}
+#endif
+
+/*
+ * Waits until property name is set to one of the count values, at most timeout_ms.
+ * If serial is not NULL, the value is only checked once the property has changed since
+ * that serial was read, so that a stale value is not mistaken for the awaited one.
+ *
+ * Returns the index of the value found, -1 on timeout.
+ */
+static int wait_for_property(const char *name, const char * const values[], int count,
+                             int timeout_ms, const unsigned *serial)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int64_t deadline = now_ms() + timeout_ms;
+    int64_t remaining;
+    int i;
+#ifdef HAVE_LIBC_SYSTEM_PROPERTIES
+    const prop_info *pi = NULL;
+    unsigned current = 0;
+
+    while (1) {
+        if (pi == NULL) {
+            pi = __system_property_find(name);
+        }
+        if (pi != NULL) {
+            current = __system_property_serial(pi);
+            if (serial == NULL || current != *serial) {
+                __system_property_read(pi, NULL, value);
+                for (i = 0; i < count; i++) {
+                    if (strcmp(value, values[i]) == 0)
+                        return i;
+                }
+            }
+        }
+        remaining = deadline - now_ms();
+        if (remaining <= 0)
+            return -1;
+        if (pi != NULL) {
+            wait_for_serial_change(pi, current, remaining);
+        } else {
+            usleep(PROPERTY_POLL_US);
+        }
+    }
+#else
+    while (1) {
+        if (property_get(name, value, NULL)) {
+            for (i = 0; i < count; i++) {
+                if (strcmp(value, values[i]) == 0)
+                    return i;
+            }
+        }
+        remaining = deadline - now_ms();
+        if (remaining <= 0)
+            return -1;
+        usleep(PROPERTY_POLL_US);
+    }
+#endif
+}
+
 static int insmod(const char *filename, const char *args)
 {
     void *module;
     unsigned int size;
     int ret;
 
+#ifdef __NR_finit_module
+    /* let the kernel read the module instead of copying it through a heap buffer */
+    int fd = TEMP_FAILURE_RETRY(open(filename, O_RDONLY | O_CLOEXEC));
+    if (fd >= 0) {
+        ret = syscall(__NR_finit_module, fd, args, 0);
+        close(fd);
+        if (ret == 0 || errno != ENOSYS)
+            return ret;
+    }
+#endif
+
     module = load_file(filename, &size);
     if (!module)
         return -1;
@@ -230,15 +352,21 @@ int is_wifi_driver_loaded() {
 int wifi_load_driver()
 {
 #ifdef WIFI_DRIVER_MODULE_PATH
-    char driver_status[PROPERTY_VALUE_MAX];
-    int count = 100; /* wait at most 20 seconds for completion */
+    static const char * const driver_states[] = { "ok", "failed" };
+    int64_t start, loaded;
 
     if (is_wifi_driver_loaded()) {
         return 0;
     }
 
-    if (insmod(DRIVER_MODULE_PATH, DRIVER_MODULE_ARG) < 0)
+    start_prepare_supplicant();
+
+    start = now_ms();
+    if (insmod(DRIVER_MODULE_PATH, DRIVER_MODULE_ARG) < 0) {
+        discard_prepare_supplicant();
         return -1;
+    }
+    loaded = now_ms();
 
     if (strcmp(FIRMWARE_LOADER,"") == 0) {
         /* usleep(WIFI_DRIVER_LOADER_DELAY); */
@@ -247,22 +375,21 @@ int wifi_load_driver()
     else {
         property_set("ctl.start", FIRMWARE_LOADER);
     }
-    sched_yield();
-    while (count-- > 0) {
-        if (property_get(DRIVER_PROP_NAME, driver_status, NULL)) {
-            if (strcmp(driver_status, "ok") == 0)
-                return 0;
-            else if (strcmp(driver_status, "failed") == 0) {
-                wifi_unload_driver();
-                return -1;
-            }
-        }
-        usleep(200000);
+    /* wait at most 20 seconds for completion */
+    switch (wait_for_property(DRIVER_PROP_NAME, driver_states, 2, 20000, NULL)) {
+    case 0:
+        ALOGD("Driver loaded: insmod %lld ms, firmware %lld ms",
+              (long long)(loaded - start), (long long)(now_ms() - loaded));
+        return 0;
+    case 1:
+        wifi_unload_driver();
+        return -1;
     }
     property_set(DRIVER_PROP_NAME, "timeout");
     wifi_unload_driver();
     return -1;
 #else
+    start_prepare_supplicant();
     property_set(DRIVER_PROP_NAME, "ok");
     return 0;
 #endif
@@ -270,6 +397,7 @@ int wifi_load_driver()
 
 int wifi_unload_driver()
 {
+    discard_prepare_supplicant();
     usleep(200000); /* allow to finish interface down */
 #ifdef WIFI_DRIVER_MODULE_PATH
     if (rmmod(DRIVER_MODULE_NAME) == 0) {
@@ -336,12 +464,44 @@ int ensure_entropy_file_exists()
     return 0;
 }
 
-int ensure_config_file_exists(const char *config_file)
+/*
+ * Copies the rest of srcfd to destfd, in the kernel when it supports copy_file_range()
+ * or sendfile() between files. Returns 0 on success, -1 with errno set on error.
+ */
+static int copy_file(int srcfd, int destfd)
 {
     char buf[2048];
+    ssize_t nread, nwritten;
+
+#ifdef __NR_copy_file_range
+    while ((nread = syscall(__NR_copy_file_range, srcfd, NULL, destfd, NULL,
+                            1 << 20, 0)) > 0)
+        ;
+    if (nread == 0)
+        return 0;
+    if (errno != ENOSYS && errno != EXDEV && errno != EINVAL)
+        return -1;
+#endif
+    while ((nread = sendfile(destfd, srcfd, NULL, 1 << 20)) > 0)
+        ;
+    if (nread == 0)
+        return 0;
+    if (errno != ENOSYS && errno != EINVAL)
+        return -1;
+
+    while ((nread = TEMP_FAILURE_RETRY(read(srcfd, buf, sizeof(buf)))) != 0) {
+        if (nread < 0)
+            return -1;
+        nwritten = TEMP_FAILURE_RETRY(write(destfd, buf, nread));
+        if (nwritten != nread)
+            return -1;
+    }
+    return 0;
+}
+
+int ensure_config_file_exists(const char *config_file)
+{
     int srcfd, destfd;
-    struct stat sb;
-    int nread;
     int ret;
 
     ret = access(config_file, R_OK|W_OK);
@@ -370,15 +530,13 @@ int ensure_config_file_exists(const char *config_file)
         return -1;
     }
 
-    while ((nread = TEMP_FAILURE_RETRY(read(srcfd, buf, sizeof(buf)))) != 0) {
-        if (nread < 0) {
-            ALOGE("Error reading \"%s\": %s", SUPP_CONFIG_TEMPLATE, strerror(errno));
-            close(srcfd);
-            close(destfd);
-            unlink(config_file);
-            return -1;
-        }
-        TEMP_FAILURE_RETRY(write(destfd, buf, nread));
+    if (copy_file(srcfd, destfd) < 0) {
+        ALOGE("Error copying \"%s\" to \"%s\": %s", SUPP_CONFIG_TEMPLATE, config_file,
+              strerror(errno));
+        close(srcfd);
+        close(destfd);
+        unlink(config_file);
+        return -1;
     }
 
     close(destfd);
@@ -401,13 +559,89 @@ int ensure_config_file_exists(const char *config_file)
     return 0;
 }
 
+/* Creates the supplicant config and entropy files and removes stale control sockets. */
+static int prepare_supplicant()
+{
+    /* Before starting the daemon, make sure its config file exists */
+    if (ensure_config_file_exists(SUPP_CONFIG_FILE) < 0) {
+        ALOGE("Wi-Fi will not be enabled");
+        return -1;
+    }
+
+    if (ensure_entropy_file_exists() < 0) {
+        ALOGE("Wi-Fi entropy file was not created");
+    }
+
+    /* Clear out any stale socket files that might be left over. */
+    wpa_ctrl_cleanup();
+    return 0;
+}
+
+static void *prepare_supplicant_thread(void *arg)
+{
+    int64_t start = now_ms();
+
+    prepare_result = prepare_supplicant();
+    prepare_time_ms = now_ms() - start;
+    return NULL;
+}
+
+static void start_prepare_supplicant()
+{
+    pthread_mutex_lock(&prepare_lock);
+    if (!prepare_started &&
+            pthread_create(&prepare_thread, NULL, prepare_supplicant_thread, NULL) == 0) {
+        prepare_started = 1;
+    }
+    pthread_mutex_unlock(&prepare_lock);
+}
+
+/*
+ * Waits for the preparation started by wifi_load_driver() and drops its result, so that
+ * the next wifi_start_supplicant() prepares again: the driver load failed or was undone.
+ */
+static void discard_prepare_supplicant()
+{
+    pthread_mutex_lock(&prepare_lock);
+    if (prepare_started) {
+        pthread_join(prepare_thread, NULL);
+        prepare_started = 0;
+    }
+    pthread_mutex_unlock(&prepare_lock);
+}
+
+/*
+ * Returns the result of the preparation started by wifi_load_driver(), waiting for it
+ * if needed, or prepares the supplicant now if it was not started.
+ */
+static int finish_prepare_supplicant()
+{
+    int64_t start = now_ms();
+    int ret;
+
+    pthread_mutex_lock(&prepare_lock);
+    if (prepare_started) {
+        pthread_join(prepare_thread, NULL);
+        prepare_started = 0;
+        ret = prepare_result;
+        ALOGD("Supplicant prepared in %lld ms, waited %lld ms",
+              (long long)prepare_time_ms, (long long)(now_ms() - start));
+    } else {
+        ret = prepare_supplicant();
+        ALOGD("Supplicant prepared in %lld ms", (long long)(now_ms() - start));
+    }
+    pthread_mutex_unlock(&prepare_lock);
+    return ret;
+}
+
 int wifi_start_supplicant(int p2p_supported)
 {
+    static const char * const started_states[] = { "running", "stopped" };
     char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
-    int count = 200; /* wait at most 20 seconds for completion */
+    const unsigned *start_serial = NULL;
 #ifdef HAVE_LIBC_SYSTEM_PROPERTIES
     const prop_info *pi;
-    unsigned serial = 0, i;
+    unsigned serial = 0;
 #endif
 
     if (p2p_supported) {
@@ -431,19 +665,10 @@ int wifi_start_supplicant(int p2p_supported)
         return 0;
     }
 
-    /* Before starting the daemon, make sure its config file exists */
-    if (ensure_config_file_exists(SUPP_CONFIG_FILE) < 0) {
-        ALOGE("Wi-Fi will not be enabled");
+    if (finish_prepare_supplicant() < 0) {
         return -1;
     }
 
-    if (ensure_entropy_file_exists() < 0) {
-        ALOGE("Wi-Fi entropy file was not created");
-    }
-
-    /* Clear out any stale socket files that might be left over. */
-    wpa_ctrl_cleanup();
-
     /* Reset sockets used for exiting from hung state */
     exit_sockets[0] = exit_sockets[1] = -1;
 
@@ -459,45 +684,28 @@ int wifi_start_supplicant(int p2p_supported)
     if (pi != NULL) {
         serial = __system_property_serial(pi);
     }
+    start_serial = &serial;
 #endif
     property_get("wifi.interface", primary_iface, WIFI_TEST_INTERFACE);
 
     property_set("ctl.start", supplicant_name);
-    sched_yield();
 
-    while (count-- > 0) {
-#ifdef HAVE_LIBC_SYSTEM_PROPERTIES
-        if (pi == NULL) {
-            pi = __system_property_find(supplicant_prop_name);
-        }
-        if (pi != NULL) {
-            /*
-             * property serial updated means that init process is scheduled
-             * after we sched_yield, further property status checking is based on this */
-            if (__system_property_serial(pi) != serial) {
-                __system_property_read(pi, NULL, supp_status);
-                if (strcmp(supp_status, "running") == 0) {
-                    return 0;
-                } else if (strcmp(supp_status, "stopped") == 0) {
-                    return -1;
-                }
-            }
-        }
-#else
-        if (property_get(supplicant_prop_name, supp_status, NULL)) {
-            if (strcmp(supp_status, "running") == 0)
-                return 0;
-        }
-#endif
-        usleep(100000);
+    /*
+     * "stopped" only means failure once the property changed after ctl.start, and
+     * without the serial it cannot be told from the state before the start.
+     * Wait at most 20 seconds for completion.
+     */
+    if (wait_for_property(supplicant_prop_name, started_states,
+                          start_serial != NULL ? 2 : 1, 20000, start_serial) == 0) {
+        return 0;
     }
     return -1;
 }
 
 int wifi_stop_supplicant(int p2p_supported)
 {
+    static const char * const stopped_state[] = { "stopped" };
     char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
-    int count = 50; /* wait at most 5 seconds for completion */
 
     if (p2p_supported) {
         strcpy(supplicant_name, P2P_SUPPLICANT_NAME);
@@ -514,30 +722,18 @@ int wifi_stop_supplicant(int p2p_supported)
     }
 
     property_set("ctl.stop", supplicant_name);
-    sched_yield();
 
-    while (count-- > 0) {
-        if (property_get(supplicant_prop_name, supp_status, NULL)) {
-            if (strcmp(supp_status, "stopped") == 0)
-                return 0;
-        }
-        usleep(100000);
+    /* wait at most 5 seconds for completion */
+    if (wait_for_property(supplicant_prop_name, stopped_state, 1, 5000, NULL) == 0) {
+        return 0;
     }
     ALOGE("Failed to stop supplicant");
     return -1;
 }
 
-int wifi_connect_on_socket_path(const char *path)
+int wifi_open_supplicant_connection(const char *path)
 {
-    char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
-
-    /* Make sure supplicant is running */
-    if (!property_get(supplicant_prop_name, supp_status, NULL)
-            || strcmp(supp_status, "running") != 0) {
-        ALOGE("Supplicant not running, cannot connect");
-        return -1;
-    }
-
+    snprintf(ctrl_path, sizeof(ctrl_path), "%s", path);
     ctrl_conn = wpa_ctrl_open(path);
     if (ctrl_conn == NULL) {
         ALOGE("Unable to open connection to supplicant on \"%s\": %s",
@@ -567,16 +763,35 @@ int wifi_connect_on_socket_path(const char *path)
     return 0;
 }
 
-/* Establishes the control and monitor socket connections on the interface */
-int wifi_connect_to_supplicant()
+int wifi_connect_on_socket_path(const char *path)
 {
-    static char path[PATH_MAX];
+    char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
 
+    /* Make sure supplicant is running */
+    if (!property_get(supplicant_prop_name, supp_status, NULL)
+            || strcmp(supp_status, "running") != 0) {
+        ALOGE("Supplicant not running, cannot connect");
+        return -1;
+    }
+
+    return wifi_open_supplicant_connection(path);
+}
+
+/* Establishes the control and monitor socket connections on the interface */
+static void get_ctrl_path(const char *iface, char *path, size_t size)
+{
     if (access(IFACE_DIR, F_OK) == 0) {
-        snprintf(path, sizeof(path), "%s/%s", IFACE_DIR, primary_iface);
+        snprintf(path, size, "%s/%s", IFACE_DIR, iface);
     } else {
-        snprintf(path, sizeof(path), "@android:wpa_%s", primary_iface);
+        snprintf(path, size, "@android:wpa_%s", iface);
     }
+}
+
+int wifi_connect_to_supplicant()
+{
+    static char path[PATH_MAX];
+
+    get_ctrl_path(primary_iface, path, sizeof(path));
     return wifi_connect_on_socket_path(path);
 }
 
@@ -602,6 +817,240 @@ int wifi_send_command(const char *cmd, char *reply, size_t *reply_len)
     return 0;
 }
 
+/*
+ * Pool of control connections for wifi_command_async(). Each thread owns one connection,
+ * opened on first use and reopened after a timeout or an error so that a late reply is
+ * not taken as the reply of the next command.
+ */
+#define COMMAND_POOL_SIZE		3
+#define COMMAND_DEFAULT_TIMEOUT_MS	10000
+#define COMMAND_REPLY_MAX		16384
+
+struct command_request {
+    struct command_request *next;
+    int id;
+    int timeout_ms;
+    wifi_command_callback callback;
+    void *cookie;
+    char cmd[];
+};
+
+static pthread_mutex_t command_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t command_cond = PTHREAD_COND_INITIALIZER;
+static struct command_request *command_head;
+static struct command_request *command_tail;
+static pthread_t command_threads[COMMAND_POOL_SIZE];
+static int command_pool_started;
+static int command_pool_exiting;
+/* set while threads are being joined: no command is queued and the pool not restarted */
+static int command_pool_stopping;
+/* written by stop_command_pool() to abort the commands being sent */
+static int command_exit_pipe[2] = { -1, -1 };
+static int next_request_id;
+
+/*
+ * Sends cmd on conn and waits at most timeout_ms for the reply. Unlike wpa_ctrl_request(),
+ * the timeout is per command. Returns 0 on success, -1 on error and -2 on timeout.
+ */
+static int ctrl_request(struct wpa_ctrl *conn, const char *cmd, char *reply, size_t *reply_len,
+                        int timeout_ms)
+{
+    int fd = wpa_ctrl_get_fd(conn);
+    int64_t deadline = now_ms() + timeout_ms;
+    int64_t remaining;
+    struct pollfd pfd[2];
+    ssize_t n;
+    int res;
+
+    if (TEMP_FAILURE_RETRY(send(fd, cmd, strlen(cmd), 0)) < 0)
+        return -1;
+
+    memset(pfd, 0, sizeof(pfd));
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = command_exit_pipe[0];
+    pfd[1].events = POLLIN;
+    while (1) {
+        remaining = deadline - now_ms();
+        if (remaining <= 0)
+            return -2;
+        res = TEMP_FAILURE_RETRY(poll(pfd, 2, remaining));
+        if (res < 0)
+            return -1;
+        if (res == 0)
+            return -2;
+        if (pfd[1].revents)
+            return -1;
+        n = TEMP_FAILURE_RETRY(recv(fd, reply, *reply_len, 0));
+        if (n < 0)
+            return -1;
+        /* pool connections are not attached, but skip unsolicited messages anyway */
+        if (n > 0 && reply[0] == '<')
+            continue;
+        *reply_len = n;
+        return 0;
+    }
+}
+
+static void *command_thread(void *arg)
+{
+    struct wpa_ctrl *conn = NULL;
+    struct command_request *req;
+    char *reply;
+    size_t reply_len;
+    int result, exiting;
+
+    reply = malloc(COMMAND_REPLY_MAX);
+    pthread_mutex_lock(&command_lock);
+    while (1) {
+        while (command_head == NULL && !command_pool_exiting)
+            pthread_cond_wait(&command_cond, &command_lock);
+        /* when stopping, fail what is still queued before exiting, so that callbacks
+         * only ever run on pool threads */
+        if (command_head == NULL)
+            break;
+        req = command_head;
+        command_head = req->next;
+        if (command_head == NULL)
+            command_tail = NULL;
+        exiting = command_pool_exiting;
+        pthread_mutex_unlock(&command_lock);
+
+        if (conn == NULL && !exiting)
+            conn = wpa_ctrl_open(ctrl_path);
+        reply_len = COMMAND_REPLY_MAX - 1;
+        if (exiting || conn == NULL || reply == NULL) {
+            result = -1;
+            reply_len = 0;
+        } else {
+            result = ctrl_request(conn, req->cmd, reply, &reply_len, req->timeout_ms);
+            if (result < 0) {
+                if (result == -2)
+                    ALOGD("'%s' command timed out.\n", req->cmd);
+                wpa_ctrl_close(conn);
+                conn = NULL;
+            }
+            if (result < 0) {
+                reply_len = 0;
+            } else if (strncmp(reply, "FAIL", 4) == 0) {
+                result = -1;
+            }
+        }
+        if (reply != NULL)
+            reply[reply_len] = '\0';
+        req->callback(req->cookie, req->id, result, reply != NULL ? reply : "", reply_len);
+        free(req);
+
+        pthread_mutex_lock(&command_lock);
+    }
+    pthread_mutex_unlock(&command_lock);
+
+    if (conn != NULL)
+        wpa_ctrl_close(conn);
+    free(reply);
+    return NULL;
+}
+
+/* Called with command_lock held. */
+static int start_command_pool()
+{
+    int i;
+
+    if (pipe(command_exit_pipe) < 0)
+        return -1;
+    command_pool_exiting = 0;
+    for (i = 0; i < COMMAND_POOL_SIZE; i++) {
+        if (pthread_create(&command_threads[i], NULL, command_thread, NULL) != 0) {
+            ALOGE("Cannot create command thread: %s", strerror(errno));
+            command_pool_exiting = 1;
+            command_pool_stopping = 1;
+            pthread_cond_broadcast(&command_cond);
+            pthread_mutex_unlock(&command_lock);
+            while (i-- > 0)
+                pthread_join(command_threads[i], NULL);
+            pthread_mutex_lock(&command_lock);
+            command_pool_stopping = 0;
+            close(command_exit_pipe[0]);
+            close(command_exit_pipe[1]);
+            command_exit_pipe[0] = command_exit_pipe[1] = -1;
+            return -1;
+        }
+    }
+    command_pool_started = 1;
+    return 0;
+}
+
+/* Stops the command threads, which fail the commands they did not send before exiting. */
+static void stop_command_pool()
+{
+    int i;
+
+    pthread_mutex_lock(&command_lock);
+    if (!command_pool_started) {
+        pthread_mutex_unlock(&command_lock);
+        return;
+    }
+    command_pool_exiting = 1;
+    command_pool_started = 0;
+    command_pool_stopping = 1;
+    pthread_cond_broadcast(&command_cond);
+    pthread_mutex_unlock(&command_lock);
+
+    TEMP_FAILURE_RETRY(write(command_exit_pipe[1], "T", 1));
+    for (i = 0; i < COMMAND_POOL_SIZE; i++)
+        pthread_join(command_threads[i], NULL);
+
+    pthread_mutex_lock(&command_lock);
+    close(command_exit_pipe[0]);
+    close(command_exit_pipe[1]);
+    command_exit_pipe[0] = command_exit_pipe[1] = -1;
+    command_pool_stopping = 0;
+    pthread_mutex_unlock(&command_lock);
+}
+
+int wifi_command_async(const char *command, int timeout_ms,
+                       wifi_command_callback callback, void *cookie)
+{
+    struct command_request *req;
+    size_t len = strlen(command);
+    int id;
+
+    if (callback == NULL)
+        return -1;
+    if (ctrl_conn == NULL) {
+        ALOGV("Not connected to wpa_supplicant - \"%s\" command dropped.\n", command);
+        return -1;
+    }
+    req = malloc(sizeof(*req) + len + 1);
+    if (req == NULL)
+        return -1;
+    memcpy(req->cmd, command, len + 1);
+    req->next = NULL;
+    req->timeout_ms = timeout_ms > 0 ? timeout_ms : COMMAND_DEFAULT_TIMEOUT_MS;
+    req->callback = callback;
+    req->cookie = cookie;
+
+    pthread_mutex_lock(&command_lock);
+    if (command_pool_stopping ||
+            (!command_pool_started && start_command_pool() < 0)) {
+        pthread_mutex_unlock(&command_lock);
+        free(req);
+        return -1;
+    }
+    if (++next_request_id <= 0)
+        next_request_id = 1;
+    id = req->id = next_request_id;
+    if (command_tail != NULL) {
+        command_tail->next = req;
+    } else {
+        command_head = req;
+    }
+    command_tail = req;
+    pthread_cond_signal(&command_cond);
+    pthread_mutex_unlock(&command_lock);
+    return id;
+}
+
 int wifi_supplicant_connection_active()
 {
     char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
@@ -655,11 +1104,14 @@ int wifi_ctrl_recv(char *reply, size_t *reply_len)
     return -2;
 }
 
-int wifi_wait_on_socket(char *buf, size_t buflen)
+/*
+ * Receives an event as sent by the supplicant, or fabricates a terminating event if the
+ * connection is closed. Returns the length of the event, NUL terminated in buf.
+ */
+static int receive_event(char *buf, size_t buflen)
 {
     size_t nread = buflen - 1;
     int result;
-    char *match, *match2;
 
     if (monitor_conn == NULL) {
         return snprintf(buf, buflen, "IFNAME=%s %s - connection closed",
@@ -687,6 +1139,17 @@ int wifi_wait_on_socket(char *buf, size_t buflen)
         return snprintf(buf, buflen, "IFNAME=%s %s - signal 0 received",
                         primary_iface, WPA_EVENT_TERMINATING);
     }
+    return nread;
+}
+
+/*
+ * Strips the message level from the NUL terminated event of length nread in buf, and
+ * returns the new length.
+ */
+static int strip_event(char *buf, size_t nread, size_t buflen)
+{
+    char *match, *match2;
+
     /*
      * Events strings are in the format
      *
@@ -727,13 +1190,229 @@ int wifi_wait_on_socket(char *buf, size_t buflen)
     return nread;
 }
 
+int wifi_wait_on_socket(char *buf, size_t buflen)
+{
+    int result;
+
+    result = receive_event(buf, buflen);
+    if (result < 0)
+        return result;
+    return strip_event(buf, result, buflen);
+}
+
+int wifi_wait_for_events(char *buf, size_t buflen, size_t *offsets, int max_events)
+{
+    size_t used;
+    ssize_t nread;
+    int count = 0;
+    int fd;
+
+    if (max_events <= 0 || buflen < 2)
+        return -1;
+
+    /* block for the first event as wifi_wait_for_event() does */
+    nread = receive_event(buf, buflen);
+    if (nread < 0)
+        return nread;
+    offsets[count++] = 0;
+    nread = strip_event(buf, nread, buflen);
+    used = nread + 1;
+    if (monitor_conn == NULL || strstr(buf, WPA_EVENT_TERMINATING) != NULL)
+        return count;
+
+    /*
+     * Then take whatever else is queued without blocking. Stop when an event of the
+     * maximum size might not fit, since a datagram that does not fit is truncated.
+     */
+    fd = wpa_ctrl_get_fd(monitor_conn);
+    while (count < max_events && buflen - used >= EVENT_BUF_SIZE) {
+        char *event = buf + used;
+
+        nread = TEMP_FAILURE_RETRY(recv(fd, event, EVENT_BUF_SIZE - 1, MSG_DONTWAIT));
+        if (nread <= 0)
+            break;
+        event[nread] = '\0';
+        offsets[count++] = used;
+        nread = strip_event(event, nread, buflen - used);
+        used += nread + 1;
+    }
+    return count;
+}
+
+/* CTRL-EVENT-* names without the prefix, indexed by WIFI_EVENT_* */
+static const char * const event_names[WIFI_EVENT_MAX] = {
+    NULL,
+    "CONNECTED",
+    "DISCONNECTED",
+    "ASSOC-REJECT",
+    "AUTH-REJECT",
+    "TERMINATING",
+    "PASSWORD-CHANGED",
+    "EAP-NOTIFICATION",
+    "EAP-STARTED",
+    "EAP-PROPOSED-METHOD",
+    "EAP-METHOD",
+    "EAP-PEER-CERT",
+    "EAP-TLS-CERT-ERROR",
+    "EAP-STATUS",
+    "EAP-SUCCESS",
+    "EAP-FAILURE",
+    "SSID-TEMP-DISABLED",
+    "SSID-REENABLED",
+    "SCAN-STARTED",
+    "SCAN-RESULTS",
+    "STATE-CHANGE",
+    "BSS-ADDED",
+    "BSS-REMOVED",
+    "LINK-SPEED",
+    "DRIVER-STATE",
+    "REGDOM-CHANGE",
+};
+
+/*
+ * Perfect hash of the names above: event_hash() maps each of them to a distinct slot of
+ * event_slots, which holds its id. Any other name is rejected by the final compare.
+ */
+#define EVENT_HASH_SIZE		64
+
+static const unsigned char event_slots[EVENT_HASH_SIZE] = {
+     0,  0, 16, 19,  0,  0,  5,  9, 12, 11,  0, 22,  3,  1, 17,  0,
+     2, 24, 10,  0,  6,  0, 23,  0,  0,  0,  0,  0,  0,  0,  0,  8,
+    15, 13,  0,  0,  0,  0, 25,  0,  0,  0,  7,  0,  0,  0, 14,  0,
+     0, 21,  0,  0, 18, 20,  0,  0,  0,  0,  0,  0,  0,  0,  0,  4,
+};
+
+static int event_hash(const char *name, size_t len)
+{
+    return (len * 13 + (unsigned char)name[0] * 28 + (unsigned char)name[len - 1]) % EVENT_HASH_SIZE;
+}
+
+static int lookup_event(const char *name, size_t len)
+{
+    static const char prefix[] = "CTRL-EVENT-";
+    const size_t prefix_len = sizeof(prefix) - 1;
+    const char *candidate;
+    int id;
+
+    if (len <= prefix_len || memcmp(name, prefix, prefix_len) != 0)
+        return WIFI_EVENT_OTHER;
+    name += prefix_len;
+    len -= prefix_len;
+    id = event_slots[event_hash(name, len)];
+    candidate = event_names[id];
+    if (id == 0 || strlen(candidate) != len || memcmp(candidate, name, len) != 0)
+        return WIFI_EVENT_OTHER;
+    return id;
+}
+
+int wifi_parse_event(const char *buf, size_t len, struct wifi_event *event)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    const char *token;
+    struct wifi_event_param *param;
+
+    /* the string API may pass the terminating NUL in len */
+    while (end > p && end[-1] == '\0')
+        end--;
+
+    event->iface = NULL;
+    event->iface_len = 0;
+    event->level = -1;
+    event->id = WIFI_EVENT_OTHER;
+    event->name = event->text = end;
+    event->name_len = event->text_len = 0;
+    event->num_params = 0;
+
+    if ((size_t)(end - p) > IFNAMELEN && memcmp(p, IFNAME, IFNAMELEN) == 0) {
+        p += IFNAMELEN;
+        event->iface = p;
+        while (p < end && *p != ' ')
+            p++;
+        event->iface_len = p - event->iface;
+        while (p < end && *p == ' ')
+            p++;
+    }
+    if (p < end && *p == '<') {
+        const char *q = p + 1;
+        int level = 0;
+        while (q < end && *q >= '0' && *q <= '9')
+            level = level * 10 + (*q++ - '0');
+        if (q < end && *q == '>' && q > p + 1) {
+            event->level = level;
+            p = q + 1;
+        }
+    }
+    if (p == end)
+        return -1;
+
+    event->name = p;
+    while (p < end && *p != ' ')
+        p++;
+    event->name_len = p - event->name;
+    event->id = lookup_event(event->name, event->name_len);
+    while (p < end && *p == ' ')
+        p++;
+    event->text = p;
+    event->text_len = end - p;
+
+    /* key=value tokens, values may be quoted; other words are skipped */
+    while (p < end && event->num_params < WIFI_EVENT_MAX_PARAMS) {
+        while (p < end && (*p == ' ' || *p == '['))
+            p++;
+        token = p;
+        while (p < end && *p != ' ' && *p != '=')
+            p++;
+        if (p == end || *p != '=' || p == token) {
+            while (p < end && *p != ' ')
+                p++;
+            continue;
+        }
+        param = &event->params[event->num_params++];
+        param->key = token;
+        param->key_len = p - token;
+        p++;
+        if (p < end && *p == '"') {
+            param->value = ++p;
+            while (p < end && *p != '"')
+                p++;
+            param->value_len = p - param->value;
+            if (p < end)
+                p++;
+        } else {
+            param->value = p;
+            while (p < end && *p != ' ')
+                p++;
+            param->value_len = p - param->value;
+            /* e.g. "[id=1 id_str=]" */
+            if (param->value_len > 0 && param->value[param->value_len - 1] == ']')
+                param->value_len--;
+        }
+    }
+    return 0;
+}
+
 int wifi_wait_for_event(char *buf, size_t buflen)
 {
     return wifi_wait_on_socket(buf, buflen);
 }
 
+int wifi_wait_for_parsed_event(char *buf, size_t buflen, struct wifi_event *event)
+{
+    int nread = receive_event(buf, buflen);
+
+    if (nread >= 0 && wifi_parse_event(buf, nread, event) < 0) {
+        /* an empty event is reported as the string API does: ignored */
+        nread = snprintf(buf, buflen, "%s", WPA_EVENT_IGNORE);
+        wifi_parse_event(buf, nread, event);
+    }
+    return nread;
+}
+
 void wifi_close_sockets()
 {
+    stop_command_pool();
+
     if (ctrl_conn != NULL) {
         wpa_ctrl_close(ctrl_conn);
         ctrl_conn = NULL;
@@ -757,18 +1436,286 @@ void wifi_close_sockets()
 
 void wifi_close_supplicant_connection()
 {
-    char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
-    int count = 50; /* wait at most 5 seconds to ensure init has stopped stupplicant */
+    static const char * const stopped_state[] = { "stopped" };
 
     wifi_close_sockets();
 
-    while (count-- > 0) {
-        if (property_get(supplicant_prop_name, supp_status, NULL)) {
-            if (strcmp(supp_status, "stopped") == 0)
-                return;
+    /* wait at most 5 seconds to ensure init has stopped supplicant */
+    wait_for_property(supplicant_prop_name, stopped_state, 1, 5000, NULL);
+}
+
+/*
+ * Connections of wifi_connect_interface(). The epoll data of a monitor holds its slot and
+ * the slot generation, so that an event read for a closed interface is not delivered to
+ * the interface that reused the slot.
+ */
+struct iface_conn {
+    int in_use;
+    /* set while wifi_close_interface() closes the connections, the slot is not reused */
+    int closing;
+    unsigned generation;
+    char name[PROPERTY_VALUE_MAX];
+    char path[PATH_MAX];
+    struct wpa_ctrl *ctrl;
+    struct wpa_ctrl *monitor;
+    wifi_event_callback callback;
+    void *cookie;
+    /* serializes commands on ctrl and protects it from being closed under a command */
+    pthread_mutex_t command_lock;
+    /* held while an event is received on monitor, which is then not closed */
+    pthread_mutex_t monitor_lock;
+};
+
+static pthread_mutex_t iface_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct iface_conn iface_conns[WIFI_MAX_INTERFACES] = {
+    [0 ... WIFI_MAX_INTERFACES - 1] = {
+        .command_lock = PTHREAD_MUTEX_INITIALIZER,
+        .monitor_lock = PTHREAD_MUTEX_INITIALIZER,
+    },
+};
+static int iface_epoll_fd = -1;
+
+#define IFACE_EVENT_DATA(slot, generation)	(((uint64_t)(generation) << 32) | (slot))
+#define IFACE_EVENT_SLOT(data)			((int)((data) & 0xffffffff))
+#define IFACE_EVENT_GENERATION(data)		((unsigned)((data) >> 32))
+
+/* Called with iface_lock held. */
+static struct iface_conn *find_iface(const char *iface)
+{
+    int i;
+
+    for (i = 0; i < WIFI_MAX_INTERFACES; i++) {
+        if (iface_conns[i].in_use && strcmp(iface_conns[i].name, iface) == 0)
+            return &iface_conns[i];
+    }
+    return NULL;
+}
+
+int wifi_connect_interface(const char *iface, wifi_event_callback callback, void *cookie)
+{
+    char path[PATH_MAX];
+
+    get_ctrl_path(iface, path, sizeof(path));
+    return wifi_connect_interface_on_path(iface, path, callback, cookie);
+}
+
+int wifi_connect_interface_on_path(const char *iface, const char *path,
+                                   wifi_event_callback callback, void *cookie)
+{
+    struct iface_conn *conn = NULL;
+    struct epoll_event ev;
+    int i, ret = -1;
+
+    if (callback == NULL || strlen(iface) >= sizeof(conn->name) ||
+            strlen(path) >= sizeof(conn->path))
+        return -1;
+
+    pthread_mutex_lock(&iface_lock);
+    if (find_iface(iface) != NULL) {
+        ALOGE("Interface %s is already connected", iface);
+        goto out;
+    }
+    for (i = 0; i < WIFI_MAX_INTERFACES && conn == NULL; i++) {
+        if (!iface_conns[i].in_use && !iface_conns[i].closing)
+            conn = &iface_conns[i];
+    }
+    if (conn == NULL) {
+        ALOGE("Cannot connect %s: too many interfaces", iface);
+        goto out;
+    }
+    if (iface_epoll_fd < 0) {
+        iface_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (iface_epoll_fd < 0) {
+            ALOGE("Cannot create epoll fd: %s", strerror(errno));
+            goto out;
+        }
+    }
+
+    conn->ctrl = wpa_ctrl_open(path);
+    if (conn->ctrl == NULL) {
+        ALOGE("Unable to open connection to supplicant on \"%s\": %s",
+             path, strerror(errno));
+        goto out;
+    }
+    conn->monitor = wpa_ctrl_open(path);
+    if (conn->monitor == NULL || wpa_ctrl_attach(conn->monitor) != 0) {
+        ALOGE("Unable to attach to supplicant on \"%s\"", path);
+        goto fail;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = IFACE_EVENT_DATA(conn - iface_conns, conn->generation);
+    if (epoll_ctl(iface_epoll_fd, EPOLL_CTL_ADD, wpa_ctrl_get_fd(conn->monitor), &ev) < 0) {
+        ALOGE("Cannot watch %s events: %s", iface, strerror(errno));
+        goto fail;
+    }
+    strcpy(conn->name, iface);
+    strcpy(conn->path, path);
+    conn->callback = callback;
+    conn->cookie = cookie;
+    conn->in_use = 1;
+    ret = 0;
+    goto out;
+
+fail:
+    if (conn->monitor != NULL)
+        wpa_ctrl_close(conn->monitor);
+    wpa_ctrl_close(conn->ctrl);
+    conn->ctrl = conn->monitor = NULL;
+out:
+    pthread_mutex_unlock(&iface_lock);
+    return ret;
+}
+
+void wifi_close_interface(const char *iface)
+{
+    struct iface_conn *conn;
+
+    /*
+     * The slot is taken out under iface_lock, then the connections are closed without it:
+     * waiting for a command in progress or detaching can take the command timeout, and
+     * must not hold up the other interfaces.
+     */
+    pthread_mutex_lock(&iface_lock);
+    conn = find_iface(iface);
+    if (conn == NULL) {
+        pthread_mutex_unlock(&iface_lock);
+        return;
+    }
+    conn->in_use = 0;
+    conn->closing = 1;
+    conn->generation++;
+    epoll_ctl(iface_epoll_fd, EPOLL_CTL_DEL, wpa_ctrl_get_fd(conn->monitor), NULL);
+    pthread_mutex_unlock(&iface_lock);
+
+    pthread_mutex_lock(&conn->command_lock);
+    pthread_mutex_lock(&conn->monitor_lock);
+    wpa_ctrl_detach(conn->monitor);
+    wpa_ctrl_close(conn->monitor);
+    if (conn->ctrl != NULL)
+        wpa_ctrl_close(conn->ctrl);
+    conn->ctrl = conn->monitor = NULL;
+    pthread_mutex_unlock(&conn->monitor_lock);
+    pthread_mutex_unlock(&conn->command_lock);
+
+    pthread_mutex_lock(&iface_lock);
+    conn->closing = 0;
+    pthread_mutex_unlock(&iface_lock);
+}
+
+int wifi_interface_command(const char *iface, const char *command,
+                           char *reply, size_t *reply_len)
+{
+    struct iface_conn *conn;
+    unsigned generation;
+    int ret;
+
+    pthread_mutex_lock(&iface_lock);
+    conn = find_iface(iface);
+    if (conn != NULL)
+        generation = conn->generation;
+    pthread_mutex_unlock(&iface_lock);
+    if (conn == NULL) {
+        ALOGV("Not connected to %s - \"%s\" command dropped.\n", iface, command);
+        return -1;
+    }
+
+    /*
+     * A command in progress on iface is waited for without iface_lock. The slot may have
+     * been closed meanwhile: closing bumps its generation before taking command_lock.
+     */
+    pthread_mutex_lock(&conn->command_lock);
+    pthread_mutex_lock(&iface_lock);
+    if (!conn->in_use || conn->generation != generation) {
+        pthread_mutex_unlock(&iface_lock);
+        pthread_mutex_unlock(&conn->command_lock);
+        ALOGV("Not connected to %s - \"%s\" command dropped.\n", iface, command);
+        return -1;
+    }
+    pthread_mutex_unlock(&iface_lock);
+
+    /* reopened after a timeout so that a late reply is not taken for the next one */
+    if (conn->ctrl == NULL)
+        conn->ctrl = wpa_ctrl_open(conn->path);
+    if (conn->ctrl == NULL) {
+        pthread_mutex_unlock(&conn->command_lock);
+        ALOGE("Unable to reopen connection to supplicant on \"%s\"", conn->path);
+        return -1;
+    }
+    ret = wpa_ctrl_request(conn->ctrl, command, strlen(command), reply, reply_len, NULL);
+    if (ret == -2) {
+        wpa_ctrl_close(conn->ctrl);
+        conn->ctrl = wpa_ctrl_open(conn->path);
+    }
+    pthread_mutex_unlock(&conn->command_lock);
+    if (ret == -2) {
+        ALOGD("'%s' command on %s timed out.\n", command, iface);
+        return -2;
+    } else if (ret < 0 || strncmp(reply, "FAIL", 4) == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int wifi_dispatch_events(int timeout_ms)
+{
+    struct epoll_event events[WIFI_MAX_INTERFACES];
+    char buf[EVENT_BUF_SIZE];
+    char name[PROPERTY_VALUE_MAX];
+    struct wifi_event event;
+    wifi_event_callback callback;
+    void *cookie;
+    struct iface_conn *conn;
+    struct wpa_ctrl *monitor;
+    size_t nread;
+    int epoll_fd, n, i, res, delivered = 0;
+
+    pthread_mutex_lock(&iface_lock);
+    epoll_fd = iface_epoll_fd;
+    pthread_mutex_unlock(&iface_lock);
+    if (epoll_fd < 0)
+        return -1;
+
+    n = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd, events, WIFI_MAX_INTERFACES, timeout_ms));
+    if (n < 0) {
+        ALOGE("epoll_wait failed: %s", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        pthread_mutex_lock(&iface_lock);
+        conn = &iface_conns[IFACE_EVENT_SLOT(events[i].data.u64)];
+        if (!conn->in_use || conn->generation != IFACE_EVENT_GENERATION(events[i].data.u64)) {
+            pthread_mutex_unlock(&iface_lock);
+            continue;
+        }
+        /* received without iface_lock, monitor_lock keeps the monitor open meanwhile */
+        pthread_mutex_lock(&conn->monitor_lock);
+        monitor = conn->monitor;
+        strcpy(name, conn->name);
+        callback = conn->callback;
+        cookie = conn->cookie;
+        pthread_mutex_unlock(&iface_lock);
+
+        nread = sizeof(buf) - 1;
+        res = -1;
+        if (events[i].events & EPOLLIN)
+            res = wpa_ctrl_recv(monitor, buf, &nread);
+        if (res < 0 || nread == 0) {
+            /* stop watching a dead connection, the owner closes it on TERMINATING */
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wpa_ctrl_get_fd(monitor), NULL);
+            nread = snprintf(buf, sizeof(buf), "IFNAME=%s %s - connection closed",
+                             name, WPA_EVENT_TERMINATING);
+        }
+        pthread_mutex_unlock(&conn->monitor_lock);
+        buf[nread] = '\0';
+
+        if (wifi_parse_event(buf, nread, &event) == 0) {
+            callback(cookie, name, &event);
+            delivered++;
         }
-        usleep(100000);
     }
+    return delivered;
 }
 
 int wifi_command(const char *command, char *reply, size_t *reply_len)
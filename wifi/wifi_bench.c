@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * wifi_bench: runs a fake wpa_supplicant on a local control socket and measures command
+ * round trips, event throughput and connect/disconnect times through the wifi_* API, so
+ * that the library can be measured without a real supplicant or driver.
+ */
+
+#include <hardware_legacy/wifi.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_IFACE		"bench0"
+#define MAX_MONITORS		8
+#define SCAN_RESULTS_LINES	40
+#define LEGACY_MAX_EVENTS	64
+#define SEND_TIMEOUT_MS		1000
+
+/*
+ * The fake supplicant speaks the control interface protocol on a datagram socket: it
+ * replies to each command from the sender's address, after the scripted latency, and
+ * sends events to the attached monitors.
+ */
+struct fake_supplicant {
+    int fd;
+    struct sockaddr_un addr;
+    pthread_t thread;
+    int latency_us;
+    volatile int exiting;
+    pthread_mutex_t lock;
+    struct sockaddr_un monitors[MAX_MONITORS];
+    socklen_t monitor_lens[MAX_MONITORS];
+    int num_monitors;
+    char scan_results[SCAN_RESULTS_LINES * 80];
+};
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-d dir] [-n iterations] [-e events] [-l latency]\n"
+            "  -d dir         directory of the fake control socket, default /data/local/tmp\n"
+            "  -n iterations  commands and connections measured, default 1000\n"
+            "  -e events      events in each burst, default 10000\n"
+            "  -l latency     fake supplicant reply latency in us, default 0\n"
+            "The interface connection is measured first, then the legacy one: wifi_command(),\n"
+            "wifi_command_async() and wifi_wait_for_event() against wifi_wait_for_events().\n"
+            "The wpa_ctrl client sockets are created in the usual directory, so run as\n"
+            "root or wifi.\n",
+            name);
+}
+
+static void fake_reply(struct fake_supplicant *fs, const char *cmd,
+                       const struct sockaddr_un *from, socklen_t from_len)
+{
+    const char *reply = "OK\n";
+    int i;
+
+    pthread_mutex_lock(&fs->lock);
+    if (strcmp(cmd, "ATTACH") == 0) {
+        if (fs->num_monitors < MAX_MONITORS) {
+            fs->monitors[fs->num_monitors] = *from;
+            fs->monitor_lens[fs->num_monitors] = from_len;
+            fs->num_monitors++;
+        } else {
+            reply = "FAIL\n";
+        }
+    } else if (strcmp(cmd, "DETACH") == 0) {
+        for (i = 0; i < fs->num_monitors; i++) {
+            if (fs->monitor_lens[i] == from_len && memcmp(&fs->monitors[i], from, from_len) == 0) {
+                fs->num_monitors--;
+                fs->monitors[i] = fs->monitors[fs->num_monitors];
+                fs->monitor_lens[i] = fs->monitor_lens[fs->num_monitors];
+                break;
+            }
+        }
+    } else if (strcmp(cmd, "PING") == 0) {
+        reply = "PONG\n";
+    } else if (strcmp(cmd, "SCAN_RESULTS") == 0) {
+        reply = fs->scan_results;
+    } else if (strcmp(cmd, "STATUS") == 0) {
+        reply = "bssid=02:00:00:00:01:00\nfreq=2437\nssid=bench\nid=0\nmode=station\n"
+                "pairwise_cipher=CCMP\ngroup_cipher=CCMP\nkey_mgmt=WPA2-PSK\n"
+                "wpa_state=COMPLETED\nip_address=192.168.1.2\naddress=02:00:00:00:00:00\n";
+    }
+    pthread_mutex_unlock(&fs->lock);
+
+    if (fs->latency_us > 0)
+        usleep(fs->latency_us);
+    sendto(fs->fd, reply, strlen(reply), 0, (const struct sockaddr *)from, from_len);
+}
+
+static void *fake_loop(void *arg)
+{
+    struct fake_supplicant *fs = arg;
+    struct pollfd pfd;
+    struct sockaddr_un from;
+    socklen_t from_len;
+    char cmd[4096];
+    ssize_t n;
+
+    pfd.fd = fs->fd;
+    pfd.events = POLLIN;
+    while (!fs->exiting) {
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        from_len = sizeof(from);
+        n = recvfrom(fs->fd, cmd, sizeof(cmd) - 1, 0, (struct sockaddr *)&from, &from_len);
+        if (n <= 0)
+            continue;
+        cmd[n] = '\0';
+        fake_reply(fs, cmd, &from, from_len);
+    }
+    return NULL;
+}
+
+static struct fake_supplicant *fake_start(const char *dir, int latency_us)
+{
+    struct fake_supplicant *fs;
+    char *line;
+    int i;
+
+    fs = calloc(1, sizeof(*fs));
+    if (fs == NULL)
+        return NULL;
+    fs->latency_us = latency_us;
+    pthread_mutex_init(&fs->lock, NULL);
+
+    line = fs->scan_results;
+    line += sprintf(line, "bssid / frequency / signal level / flags / ssid\n");
+    for (i = 0; i < SCAN_RESULTS_LINES; i++) {
+        line += sprintf(line, "02:00:00:00:%02x:%02x\t%d\t%d\t[WPA2-PSK-CCMP][ESS]\tbench-%d\n",
+                        i >> 8, i & 0xff, 2412 + (i % 13) * 5, -40 - i, i);
+    }
+
+    fs->addr.sun_family = AF_UNIX;
+    snprintf(fs->addr.sun_path, sizeof(fs->addr.sun_path), "%s/wifi_bench_%d", dir, getpid());
+    unlink(fs->addr.sun_path);
+    fs->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fs->fd < 0 || bind(fs->fd, (struct sockaddr *)&fs->addr, sizeof(fs->addr)) < 0) {
+        fprintf(stderr, "could not bind %s: %s\n", fs->addr.sun_path, strerror(errno));
+        goto fail;
+    }
+    if (pthread_create(&fs->thread, NULL, fake_loop, fs) != 0)
+        goto fail;
+    return fs;
+
+fail:
+    if (fs->fd >= 0)
+        close(fs->fd);
+    free(fs);
+    return NULL;
+}
+
+static void fake_stop(struct fake_supplicant *fs)
+{
+    fs->exiting = 1;
+    pthread_join(fs->thread, NULL);
+    close(fs->fd);
+    unlink(fs->addr.sun_path);
+    free(fs);
+}
+
+struct burst {
+    struct fake_supplicant *fs;
+    int count;
+    volatile int stop;
+};
+
+static void drop_monitor(struct fake_supplicant *fs, const struct sockaddr_un *addr,
+                         socklen_t len)
+{
+    int i;
+
+    pthread_mutex_lock(&fs->lock);
+    for (i = 0; i < fs->num_monitors; i++) {
+        if (fs->monitor_lens[i] == len && memcmp(&fs->monitors[i], addr, len) == 0) {
+            fs->num_monitors--;
+            fs->monitors[i] = fs->monitors[fs->num_monitors];
+            fs->monitor_lens[i] = fs->monitor_lens[fs->num_monitors];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fs->lock);
+}
+
+/*
+ * Sends a burst of BSS-ADDED events, as during a scan, to every monitor. A full monitor
+ * queue is what a flood looks like, so the send is retried until the reader catches up,
+ * for at most SEND_TIMEOUT_MS, or until the reader gives up and sets stop.
+ */
+static void *burst_thread(void *arg)
+{
+    struct burst *b = arg;
+    struct fake_supplicant *fs = b->fs;
+    struct sockaddr_un monitors[MAX_MONITORS];
+    socklen_t monitor_lens[MAX_MONITORS];
+    char event[128];
+    int64_t deadline;
+    int i, j, len, num_monitors;
+
+    for (i = 0; i < b->count && !b->stop; i++) {
+        len = snprintf(event, sizeof(event),
+                       "IFNAME=%s <3>CTRL-EVENT-BSS-ADDED %d 02:00:00:00:%02x:%02x",
+                       BENCH_IFACE, i, (i >> 8) & 0xff, i & 0xff);
+        /* send on a copy, fake_loop() must keep answering ATTACH and DETACH meanwhile */
+        pthread_mutex_lock(&fs->lock);
+        num_monitors = fs->num_monitors;
+        memcpy(monitors, fs->monitors, num_monitors * sizeof(monitors[0]));
+        memcpy(monitor_lens, fs->monitor_lens, num_monitors * sizeof(monitor_lens[0]));
+        pthread_mutex_unlock(&fs->lock);
+
+        for (j = 0; j < num_monitors && !b->stop; j++) {
+            deadline = now_ns() + SEND_TIMEOUT_MS * 1000000LL;
+            while (sendto(fs->fd, event, len, MSG_DONTWAIT, (struct sockaddr *)&monitors[j],
+                          monitor_lens[j]) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (b->stop || now_ns() > deadline)
+                        break;
+                    usleep(50);
+                } else if (errno != EINTR) {
+                    /* the monitor went away without DETACH, as the supplicant does, drop it */
+                    drop_monitor(fs, &monitors[j], monitor_lens[j]);
+                    break;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static int received_events;
+
+static void count_event(void *cookie, const char *iface, const struct wifi_event *event)
+{
+    if (event->id == WIFI_EVENT_BSS_ADDED)
+        received_events++;
+}
+
+/*
+ * Reads a burst of events on the legacy connection, one event per call with batch 0,
+ * with wifi_wait_for_events() otherwise, and reports the calls it took.
+ */
+static int bench_legacy_events(struct fake_supplicant *fs, int events, int batch)
+{
+    static char buf[LEGACY_MAX_EVENTS * 1024];
+    size_t offsets[LEGACY_MAX_EVENTS];
+    struct burst burst;
+    pthread_t burst_tid;
+    int64_t start, end;
+    int received = 0, calls = 0;
+    int i, n;
+
+    burst.fs = fs;
+    burst.count = events;
+    burst.stop = 0;
+    start = now_ns();
+    if (pthread_create(&burst_tid, NULL, burst_thread, &burst) != 0)
+        return -1;
+    while (received < events) {
+        if (batch) {
+            n = wifi_wait_for_events(buf, sizeof(buf), offsets, LEGACY_MAX_EVENTS);
+        } else {
+            n = wifi_wait_for_event(buf, sizeof(buf)) > 0;
+            offsets[0] = 0;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "legacy events stalled at %d\n", received);
+            burst.stop = 1;
+            break;
+        }
+        calls++;
+        for (i = 0; i < n; i++) {
+            if (strstr(buf + offsets[i], "CTRL-EVENT-BSS-ADDED") != NULL)
+                received++;
+        }
+    }
+    end = now_ns();
+    pthread_join(burst_tid, NULL);
+    printf("%-14s %d in %.3f ms, %.0f events/s, %d calls\n",
+           batch ? "wait_events:" : "wait_event:", received, (end - start) / 1e6,
+           received * 1e9 / (end - start), calls);
+    return received == events ? 0 : -1;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    int64_t la = *(const int64_t *)a;
+    int64_t lb = *(const int64_t *)b;
+
+    return (la > lb) - (la < lb);
+}
+
+static void print_latency(const char *name, int64_t *samples, int count)
+{
+    qsort(samples, count, sizeof(*samples), compare_ns);
+    printf("%-14s us: p50 %.1f p90 %.1f p99 %.1f max %.1f\n", name,
+           samples[count * 50 / 100] / 1e3,
+           samples[count * 90 / 100] / 1e3,
+           samples[count * 99 / 100] / 1e3,
+           samples[count - 1] / 1e3);
+}
+
+/* measures cmd on the interface connection of iface, on the legacy one with a NULL iface */
+static int bench_commands(const char *name, const char *iface, const char *cmd,
+                          int iterations, int64_t *samples)
+{
+    char reply[4096];
+    size_t reply_len;
+    int64_t start;
+    int i, ret;
+
+    for (i = 0; i < iterations; i++) {
+        reply_len = sizeof(reply) - 1;
+        start = now_ns();
+        if (iface != NULL)
+            ret = wifi_interface_command(iface, cmd, reply, &reply_len);
+        else
+            ret = wifi_command(cmd, reply, &reply_len);
+        if (ret < 0) {
+            fprintf(stderr, "%s failed at iteration %d\n", cmd, i);
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+    }
+    print_latency(name, samples, iterations);
+    return 0;
+}
+
+struct async_bench {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int64_t *samples;
+    int completed;
+    int failed;
+};
+
+struct async_request {
+    struct async_bench *ab;
+    int64_t queued_ns;
+};
+
+static void async_done(void *cookie, int request_id, int result,
+                       const char *reply, size_t reply_len)
+{
+    struct async_request *req = cookie;
+    struct async_bench *ab = req->ab;
+    int64_t now = now_ns();
+
+    pthread_mutex_lock(&ab->lock);
+    ab->samples[ab->completed++] = now - req->queued_ns;
+    if (result < 0)
+        ab->failed++;
+    pthread_cond_signal(&ab->cond);
+    pthread_mutex_unlock(&ab->lock);
+}
+
+/*
+ * Queues iterations commands at once on the wifi_command_async() pool and reports the
+ * latency from queueing to completion, and the throughput of the pool.
+ */
+static int bench_async(const char *name, const char *cmd, int iterations, int64_t *samples)
+{
+    struct async_bench ab;
+    struct async_request *reqs;
+    int64_t start, end;
+    int queued;
+
+    reqs = calloc(iterations, sizeof(*reqs));
+    if (reqs == NULL)
+        return -1;
+    memset(&ab, 0, sizeof(ab));
+    pthread_mutex_init(&ab.lock, NULL);
+    pthread_cond_init(&ab.cond, NULL);
+    ab.samples = samples;
+
+    start = now_ns();
+    for (queued = 0; queued < iterations; queued++) {
+        reqs[queued].ab = &ab;
+        reqs[queued].queued_ns = now_ns();
+        if (wifi_command_async(cmd, 0, async_done, &reqs[queued]) < 0) {
+            fprintf(stderr, "%s not queued at iteration %d\n", cmd, queued);
+            break;
+        }
+    }
+    pthread_mutex_lock(&ab.lock);
+    while (ab.completed < queued)
+        pthread_cond_wait(&ab.cond, &ab.lock);
+    pthread_mutex_unlock(&ab.lock);
+    end = now_ns();
+
+    if (queued > 0) {
+        print_latency(name, samples, queued);
+        printf("%-14s %d in %.3f ms, %.0f commands/s, %d failed\n", name, queued,
+               (end - start) / 1e6, queued * 1e9 / (end - start), ab.failed);
+    }
+    pthread_cond_destroy(&ab.cond);
+    pthread_mutex_destroy(&ab.lock);
+    free(reqs);
+    return queued == iterations && ab.failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = "/data/local/tmp";
+    struct fake_supplicant *fs;
+    struct burst burst;
+    pthread_t burst_tid;
+    int64_t *connect_ns, *close_ns, start, end;
+    int iterations = 1000;
+    int events = 10000;
+    int latency_us = 0;
+    int i, opt, ret = 1;
+
+    while ((opt = getopt(argc, argv, "d:n:e:l:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'e':
+            events = atoi(optarg);
+            break;
+        case 'l':
+            latency_us = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0 || events <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    connect_ns = calloc(iterations, sizeof(*connect_ns));
+    close_ns = calloc(iterations, sizeof(*close_ns));
+    if (connect_ns == NULL || close_ns == NULL)
+        return 1;
+    fs = fake_start(dir, latency_us);
+    if (fs == NULL)
+        return 1;
+
+    for (i = 0; i < iterations; i++) {
+        start = now_ns();
+        if (wifi_connect_interface_on_path(BENCH_IFACE, fs->addr.sun_path,
+                                           count_event, NULL) < 0) {
+            fprintf(stderr, "connect failed at iteration %d\n", i);
+            goto out;
+        }
+        connect_ns[i] = now_ns() - start;
+        start = now_ns();
+        wifi_close_interface(BENCH_IFACE);
+        close_ns[i] = now_ns() - start;
+    }
+    print_latency("connect", connect_ns, iterations);
+    print_latency("disconnect", close_ns, iterations);
+
+    if (wifi_connect_interface_on_path(BENCH_IFACE, fs->addr.sun_path, count_event, NULL) < 0) {
+        fprintf(stderr, "connect failed\n");
+        goto out;
+    }
+    if (bench_commands("PING", BENCH_IFACE, "PING", iterations, connect_ns) < 0 ||
+            bench_commands("STATUS", BENCH_IFACE, "STATUS", iterations, connect_ns) < 0 ||
+            bench_commands("SCAN_RESULTS", BENCH_IFACE, "SCAN_RESULTS", iterations,
+                           connect_ns) < 0)
+        goto out;
+
+    burst.fs = fs;
+    burst.count = events;
+    burst.stop = 0;
+    start = now_ns();
+    if (pthread_create(&burst_tid, NULL, burst_thread, &burst) != 0)
+        goto out;
+    while (received_events < events) {
+        if (wifi_dispatch_events(1000) <= 0) {
+            fprintf(stderr, "events stalled at %d\n", received_events);
+            burst.stop = 1;
+            break;
+        }
+    }
+    end = now_ns();
+    pthread_join(burst_tid, NULL);
+    printf("events:        %d in %.3f ms, %.0f events/s\n", received_events,
+           (end - start) / 1e6, received_events * 1e9 / (end - start));
+    if (received_events != events)
+        goto out;
+
+    /* the bursts go to every monitor, the interface one would fill up and stall them */
+    wifi_close_interface(BENCH_IFACE);
+    if (wifi_open_supplicant_connection(fs->addr.sun_path) < 0) {
+        fprintf(stderr, "legacy connect failed\n");
+        goto out;
+    }
+    if (bench_commands("legacy PING", NULL, "PING", iterations, connect_ns) == 0 &&
+            bench_commands("legacy STATUS", NULL, "STATUS", iterations, connect_ns) == 0 &&
+            bench_async("async PING", "PING", iterations, connect_ns) == 0 &&
+            bench_async("async SCAN", "SCAN_RESULTS", iterations, connect_ns) == 0 &&
+            bench_legacy_events(fs, events, 0) == 0 &&
+            bench_legacy_events(fs, events, 1) == 0)
+        ret = 0;
+    wifi_close_sockets();
+
+out:
+    wifi_close_interface(BENCH_IFACE);
+    fake_stop(fs);
+    return ret;
+}